@@ -0,0 +1,163 @@
+//**********************************/
+// description: 基准测试公共部分
+//**********************************/
+// 四个实验程序以 -R 运行各自的基准时共用: 带种子的随机数、计时、延迟直方图、插桩计数器和结果输出
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_BUCKETS 40 // 延迟直方图桶数, 第 i 桶记录 [2^i, 2^(i+1)) 纳秒
+#define BENCH_SCALES 3   // 每个基准依次以最大规模的 1/100, 1/10, 1 倍运行
+
+// 热路径插桩计数器, 编译时加 -DNO_COUNTERS 整体去除
+#ifdef NO_COUNTERS
+#define COUNT(counter, n) ((void)0)
+#else
+#define COUNT(counter, n) ((counter) += (n))
+#endif
+
+typedef struct {
+    const char *name;
+    long *value;
+} BenchCounter;
+
+typedef struct {
+    long buckets[BENCH_BUCKETS];
+    long count;
+    long max_ns;
+    double total_ns;
+} BenchHistogram;
+
+static uint64_t bench_state = 1;
+static FILE *bench_out = NULL;
+static int bench_csv = 0;
+
+// xorshift64*, 不依赖 C 库的 rand(), 同一种子在任何平台上生成相同的工作负载
+static inline void bench_seed(uint64_t seed) {
+    bench_state = seed * 0x9E3779B97F4A7C15ULL | 1;
+}
+
+static inline uint32_t bench_rand() {
+    bench_state ^= bench_state >> 12;
+    bench_state ^= bench_state << 25;
+    bench_state ^= bench_state >> 27;
+    return (uint32_t)((bench_state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+// [0, n) 内的随机整数
+static inline int bench_range(int n) {
+    return (int)(bench_rand() % (uint32_t)n);
+}
+
+static inline long bench_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// 第 i 个规模, 至少为 1
+static inline int bench_scale(int max_scale, int i) {
+    for (int k = i; k < BENCH_SCALES - 1; ++k) {
+        max_scale /= 10;
+    }
+    return max_scale > 0 ? max_scale : 1;
+}
+
+static inline void bench_record(BenchHistogram *h, long ns) {
+    int i = ns > 1 ? 63 - __builtin_clzll(ns) : 0;
+    h->buckets[i < BENCH_BUCKETS ? i : BENCH_BUCKETS - 1]++;
+    h->count++;
+    h->total_ns += ns;
+    if (ns > h->max_ns) {
+        h->max_ns = ns;
+    }
+}
+
+// 分位数 q 所在桶的上界, 不超过实测最大值
+static inline long bench_percentile(BenchHistogram *h, double q) {
+    long target = (long)(q * h->count + 0.999999), seen = 0;
+    for (int i = 0; i < BENCH_BUCKETS; ++i) {
+        seen += h->buckets[i];
+        if (seen >= target && seen > 0) {
+            long bound = 2L << i;
+            return bound < h->max_ns ? bound : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
+
+static inline void bench_reset(BenchHistogram *h, BenchCounter *counters, int counter_count) {
+    memset(h, 0, sizeof(*h));
+    for (int i = 0; i < counter_count; ++i) {
+        *counters[i].value = 0;
+    }
+}
+
+// 打开结果文件, 以 .csv 结尾时输出 CSV, 否则每行一个 JSON 对象; 为空或 "-" 时输出到标准输出
+// 以追加方式打开, 几个程序的结果可以写进同一个文件, 便于逐次对比
+static inline int bench_open(const char *path) {
+    if (!path || strcmp(path, "-") == 0) {
+        bench_out = stdout;
+        return 0;
+    }
+    bench_out = fopen(path, "a");
+    if (!bench_out) {
+        perror("打开结果文件失败");
+        return -1;
+    }
+    size_t n = strlen(path);
+    bench_csv = n > 4 && strcmp(path + n - 4, ".csv") == 0;
+    fseek(bench_out, 0, SEEK_END);
+    if (bench_csv && ftell(bench_out) == 0) {
+        fprintf(bench_out, "program,workload,scale,seed,ops,wall_s,ops_per_s,mean_ns,p50_ns,p90_ns,p99_ns,max_ns,counters\n");
+    }
+    return 0;
+}
+
+static inline void bench_close() {
+    if (bench_out && bench_out != stdout) {
+        fclose(bench_out);
+    }
+    bench_out = NULL;
+}
+
+// 输出一次运行的结果: 墙钟时间、吞吐量、延迟分位数与直方图、计数器
+// ops 为完成的操作数, 直方图记录的可以是单个操作, 也可以是一批操作的耗时
+static inline void bench_report(const char *program, const char *workload, int scale, uint64_t seed, long ops, long wall_ns,
+                                BenchHistogram *h, BenchCounter *counters, int counter_count) {
+    double wall_s = wall_ns / 1e9;
+    double mean = h->count ? h->total_ns / h->count : 0;
+    long p50 = bench_percentile(h, 0.5), p90 = bench_percentile(h, 0.9), p99 = bench_percentile(h, 0.99);
+    if (bench_csv) {
+        fprintf(bench_out, "%s,%s,%d,%llu,%ld,%.6f,%.1f,%.1f,%ld,%ld,%ld,%ld,", program, workload, scale,
+                (unsigned long long)seed, ops, wall_s, wall_s > 0 ? ops / wall_s : 0, mean, p50, p90, p99, h->max_ns);
+        for (int i = 0; i < counter_count; ++i) {
+            fprintf(bench_out, "%s%s=%ld", i ? ";" : "", counters[i].name, *counters[i].value);
+        }
+        fprintf(bench_out, "\n");
+    } else {
+        fprintf(bench_out, "{\"program\":\"%s\",\"workload\":\"%s\",\"scale\":%d,\"seed\":%llu,\"ops\":%ld,\"wall_s\":%.6f,\"ops_per_s\":%.1f,",
+                program, workload, scale, (unsigned long long)seed, ops, wall_s, wall_s > 0 ? ops / wall_s : 0);
+        fprintf(bench_out, "\"latency_ns\":{\"mean\":%.1f,\"p50\":%ld,\"p90\":%ld,\"p99\":%ld,\"max\":%ld,\"log2_histogram\":[",
+                mean, p50, p90, p99, h->max_ns);
+        int last = BENCH_BUCKETS - 1;
+        while (last > 0 && h->buckets[last] == 0) {
+            last--;
+        }
+        for (int i = 0; i <= last; ++i) {
+            fprintf(bench_out, "%s%ld", i ? "," : "", h->buckets[i]);
+        }
+        fprintf(bench_out, "]},\"counters\":{");
+        for (int i = 0; i < counter_count; ++i) {
+            fprintf(bench_out, "%s\"%s\":%ld", i ? "," : "", counters[i].name, *counters[i].value);
+        }
+        fprintf(bench_out, "}}\n");
+    }
+    fflush(bench_out);
+}
+
+#endif
@@ -3,36 +3,51 @@
 // data: 2024.12.11
 // description: 外存管理
 //**********************************/
+#include "bench.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+
+#define MAX_REQUESTS 10000 // 请求序列的最大长度
+#define BATCHES 10         // 基准测试中每个规模调度的批数
 
 // 记录每种算法中都需要的数据
-int num;          //磁道数
-int request[100]; //请求磁道序列
-int begin;        //开始磁道位置
-int cross;        //横跨的总数
-int k;            //每次横跨的磁道数
-int re[100];      //复制初始序列
-int r[100];       //记录每个算法执行后序列
+int num;                   //磁道数
+int request[MAX_REQUESTS]; //请求磁道序列
+int begin;                 //开始磁道位置
+int cross;                 //横跨的总数
+int k;                     //每次横跨的磁道数
+int re[MAX_REQUESTS];      //复制初始序列
+int r[MAX_REQUESTS];       //记录每个算法执行后序列
+int quiet = 0;             //基准测试时不输出访问顺序
+
+// 插桩计数器
+long sminCalls = 0;     // Smin 调用次数
+long sminSteps = 0;     // Smin 比较的磁道数
+long tracksCrossed = 0; // 基准测试中横跨的总磁道数
+
+#define show(...) (quiet ? 0 : printf(__VA_ARGS__))
 
 void FCFS() { //先来先服务调度算法
     cross = abs(begin - request[0]);
-    printf("\n先来先服务调度（FCFS）算法：\n    访问顺序：      %3d", begin);
+    show("\n先来先服务调度（FCFS）算法：\n    访问顺序：      %3d", begin);
     for (int i = 0; i < num; i++)
-        printf(" %3d", request[i]);
-    printf("\n    横跨磁道数为：      %3d", abs(begin - request[0]));
+        show(" %3d", request[i]);
+    show("\n    横跨磁道数为：      %3d", abs(begin - request[0]));
     for (int i = 1; i < num; i++) {
         k = abs(request[i - 1] - request[i]);
-        printf(" %3d", k);
+        show(" %3d", k);
         cross += k;
     }
-    printf("\n    横跨的总磁道数：    %3d", cross);
-    printf("\n    平均寻道长度：      %.5f\n", 1.0 * cross / num);
+    show("\n    横跨的总磁道数：    %3d", cross);
+    show("\n    平均寻道长度：      %.5f\n", 1.0 * cross / num);
 }
 
 int Smin(int b, int re[]) { //返回离开始磁道b最近的磁道下标
     int min = abs(b - re[0]);
     int j = 0;
+    COUNT(sminCalls, 1);
+    COUNT(sminSteps, num);
     for (int i = 1; i < num; i++)
         if (abs(b - re[i]) < min) {
             min = abs(b - re[i]);
@@ -43,30 +58,30 @@ int Smin(int b, int re[]) { //返回离开始磁道b最近的磁道下标
 
 void SSTF() { //最短寻道时间优先调度算法
     int c = 0, b = begin;
-    printf("\n最短寻道时间优先（SSTF）算法：\n    访问顺序：      %3d", begin);
+    show("\n最短寻道时间优先（SSTF）算法：\n    访问顺序：      %3d", begin);
     for (int i = 0; i < num; i++) {
         c = Smin(b, re); //返回最近的磁道下标
         b = re[c];       //将最近的磁道作为开始
         re[c] = 9999999; //将已经访问过的磁道设为很大值
-        printf(" %3d", b);
+        show(" %3d", b);
         r[i] = b;
     }
     cross = abs(begin - r[0]);
-    printf("\n    横跨磁道数为：      %3d", abs(begin - r[0]));
+    show("\n    横跨磁道数为：      %3d", abs(begin - r[0]));
     for (int i = 1; i < num; i++) {
         k = abs(r[i - 1] - r[i]);
-        printf(" %3d", k);
+        show(" %3d", k);
         cross += k;
     }
-    printf("\n    横跨的总磁道数：    %3d", cross);
-    printf("\n    平均寻道长度：      %.5f\n", 1.0 * cross / num);
+    show("\n    横跨的总磁道数：    %3d", cross);
+    show("\n    平均寻道长度：      %.5f\n", 1.0 * cross / num);
 }
 
 void SCAN() { //电梯调度算法
     int c = 0, b = begin;
     for (int i = 0; i < num; i++) // SSTF时re[]已改变
         re[i] = request[i];
-    printf("\n电梯调度（SCAN）算法：\n    访问顺序：      %3d", begin);
+    show("\n电梯调度（SCAN）算法：\n    访问顺序：      %3d", begin);
     for (int i = 0; i < num - 1; i++) {
         for (int j = 0; j < num - i - 1; j++) {
             if (re[j] > re[j + 1]) {
@@ -77,53 +92,121 @@ void SCAN() { //电梯调度算法
         }
     }
     for (int i = 0; i < num; i++)
-        if (re[i] > b) {
-            printf(" %3d", re[i]);
+        if (re[i] >= b) { // 与开始磁道相同的请求最先服务, 否则两趟都会漏掉它
+            show(" %3d", re[i]);
             r[c++] = re[i];
         }
     for (int i = num - 1; i >= 0; i--)
         if (re[i] < b) {
-            printf(" %3d", re[i]);
+            show(" %3d", re[i]);
             r[c++] = re[i];
         }
     cross = abs(begin - r[0]);
-    printf("\n    横跨磁道数为：      %3d", abs(begin - r[0]));
+    show("\n    横跨磁道数为：      %3d", abs(begin - r[0]));
     for (int i = 1; i < num; i++) {
         k = abs(r[i - 1] - r[i]);
-        printf(" %3d", k);
+        show(" %3d", k);
         cross += k;
     }
-    printf("\n    横跨的总磁道数：    %3d", cross);
-    printf("\n    平均寻道长度：      %.5f\n", 1.0 * cross / num);
+    show("\n    横跨的总磁道数：    %3d", cross);
+    show("\n    平均寻道长度：      %.5f\n", 1.0 * cross / num);
 }
 
 void CSCAN() { //循环式单向电梯调度算法
     int c = 0, b = begin;
-    printf("\n循环式单向电梯调度（CSCAN）算法：\n    访问顺序：      %3d", begin);
+    show("\n循环式单向电梯调度（CSCAN）算法：\n    访问顺序：      %3d", begin);
     for (int i = 0; i < num; i++)
-        if (re[i] > b) {
-            printf(" %3d", re[i]);
+        if (re[i] >= b) {
+            show(" %3d", re[i]);
             r[c++] = re[i];
         }
     for (int i = 0; i < num; i++)
         if (re[i] < b) {
-            printf(" %3d", re[i]);
+            show(" %3d", re[i]);
             r[c++] = re[i];
         }
     cross = abs(begin - r[0]);
-    printf("\n    横跨磁道数为：      %3d", abs(begin - r[0]));
+    show("\n    横跨磁道数为：      %3d", abs(begin - r[0]));
     for (int i = 1; i < num; i++) {
         k = abs(r[i - 1] - r[i]);
-        printf(" %3d", k);
+        show(" %3d", k);
         cross += k;
     }
-    printf("\n    横跨的总磁道数：    %3d", cross);
-    printf("\n    平均寻道长度：      %.5f\n", 1.0 * cross / num);
+    show("\n    横跨的总磁道数：    %3d", cross);
+    show("\n    平均寻道长度：      %.5f\n", 1.0 * cross / num);
+}
+
+static int compareTrack(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
 }
 
-int main() {
+// 基准测试: 每个规模以同一种子生成 BATCHES 批随机请求, 四种算法各调度一遍, 直方图记录每批的调度耗时
+void benchmark(int maxScale, uint64_t seed) {
+    const char *names[] = {"fcfs", "sstf", "scan", "cscan"};
+    void (*algorithms[])() = {FCFS, SSTF, SCAN, CSCAN};
+    BenchCounter counters[] = {{"smin_calls", &sminCalls}, {"smin_steps", &sminSteps}, {"tracks_crossed", &tracksCrossed}};
+    BenchHistogram histogram;
+    quiet = 1;
+    for (int i = 0; i < BENCH_SCALES; ++i) {
+        num = bench_scale(maxScale, i);
+        if (num > MAX_REQUESTS)
+            num = MAX_REQUESTS;
+        for (int a = 0; a < 4; ++a) {
+            long wall = 0;
+            bench_reset(&histogram, counters, 3);
+            bench_seed(seed);
+            for (int batch = 0; batch < BATCHES; ++batch) {
+                for (int j = 0; j < num; j++) {
+                    request[j] = bench_range(200);
+                    re[j] = request[j];
+                }
+                begin = bench_range(200);
+                if (a == 3) // CSCAN 沿用 SCAN 排好序的 re[]
+                    qsort(re, num, sizeof(int), compareTrack);
+                long start = bench_now_ns();
+                algorithms[a]();
+                long t = bench_now_ns() - start;
+                bench_record(&histogram, t);
+                wall += t;
+                tracksCrossed += cross;
+            }
+            bench_report("disk", names[a], num, seed, (long)BATCHES * num, wall, &histogram, counters, 3);
+        }
+    }
+    quiet = 0;
+}
+
+int main(int argc, char *argv[]) {
+    int maxScale = 0, opt;
+    uint64_t seed = 1;
+    const char *output = NULL;
+    while ((opt = getopt(argc, argv, "R:S:o:")) != -1) {
+        switch (opt) {
+        case 'R':
+            maxScale = atoi(optarg);
+            break;
+        case 'S':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            fprintf(stderr, "用法: %s [-R 基准最大规模] [-S 种子] [-o 结果文件(.json/.csv)]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (maxScale > 0) {
+        if (bench_open(output) != 0)
+            return 1;
+        benchmark(maxScale, seed);
+        bench_close();
+        return 0;
+    }
     printf("磁道调度模拟实现\n\n请输入调度磁道数量:    ");
     scanf("%d", &num);
+    if (num > MAX_REQUESTS)
+        num = MAX_REQUESTS;
     for (int i = 0; i < num; i++) {
         request[i] = rand() % 200; // 生成0-199以内的随机数作为磁道号
         re[i] = request[i];
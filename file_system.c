@@ -4,18 +4,51 @@
 // description: 文件系统
 //**********************************/
 
+#define _GNU_SOURCE
+#include "bench.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
+#include <unistd.h>
 
-#define DISK_SIZE 8192 // 磁盘大小 8MB
-#define BLOCK_SIZE 512 // 块大小 512 bytes
+#define DISK_SIZE (8 * 1024 * 1024) // 磁盘大小 8MB
+#define BLOCK_SIZE 512               // 块大小 512 bytes
 #define BLOCK_COUNT (DISK_SIZE / BLOCK_SIZE)
-#define MAX_FILES 100
-#define MAX_DIRS 10
+#define MAX_BLOCK_COUNT (INT32_MAX / BLOCK_SIZE) // 块号乘块大小须在 int 范围内
+#define WORD_BITS 64 // 位示图每个字的位数
+#define DIR_INIT_CAPACITY 16 // 目录散列表初始容量, 须为 2 的幂
+#define MAX_PATH 256         // 路径最大长度
+#define DCACHE_SIZE 1024     // 目录项缓存槽数
+#define DCACHE_LOCKS 64      // 目录项缓存的锁数, 各槽按序号分摊
+#define MAX_EXTENTS 8   // 索引节点内的区段数, 更多的区段存放在溢出节点链中
+#define NODE_EXTENTS 31 // 每个溢出区段节点容纳的区段数
+#define INODE_COUNT 16384 // 默认索引节点数
+#define MAX_INODE_COUNT (1 << 20) // 索引节点数上限
+#define MAX_OPEN_FILES 64 // 同时打开的文件句柄数上限
+#define CACHE_BUFFERS 256 // 缓冲块数
+#define CACHE_SHARDS 8    // 缓存分片数, 块按块号分到各片, 每片各有一把锁
+#define CACHE_HASH 509    // 每片的缓冲块散列桶数
+#define READ_AHEAD 8      // 顺序读时额外预读的块数
+#define IMAGE_MAGIC 0x5346534F // 磁盘映像魔数 "OSFS"
+#define IMAGE_VERSION 5
+#define DISK_TRACKS 200   // 模拟磁盘的磁道数, 与 disk.c 中的磁道号范围相同
+#define DISK_QUEUE 64     // 模拟磁盘的请求队列深度
+#define SEEK_START_US 500 // 寻道的固定开销(微秒)
+#define SEEK_TRACK_US 40  // 每横跨一个磁道的开销(微秒)
+#define TRANSFER_US 20    // 传输一块的开销(微秒)
+#define FEATURE_DEDUP 1 // 映像中可能有被多个文件共享的块, 挂载时须重建引用计数
+#define IMAGE_ALIGN 4096              // 映像各区按页对齐, 以便元数据区与数据区分别映射
+#define JOURNAL_SIZE (1024 * 1024)    // 日志区最小大小
+#define JOURNAL_MAGIC 0x4C4E524A      // 日志魔数 "JRNL"
+#define JOURNAL_GROUP 16              // 默认每组提交的事务数
 
 typedef enum {
     FILE_NORMAL,
@@ -24,161 +57,3046 @@ typedef enum {
     FILE_SYSTEM
 } FileAttribute;
 
-char disk_memory[DISK_SIZE];
+// 磁盘映像布局: 超级块 | 日志区 | 位示图 | 索引节点表 | 溢出区段节点表 | 数据区, 各区按页对齐
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int32_t block_size;
+    int32_t block_count;
+    int32_t inode_count;
+    int32_t features;       // FEATURE_* 标志
+    int64_t journal_offset; // 日志区在映像中的偏移
+    int64_t journal_size;   // 日志区大小
+    int64_t bitmap_offset;  // 位示图区偏移
+    int64_t inode_offset;   // 索引节点表偏移
+    int64_t data_offset;    // 数据区偏移
+    int64_t image_size;     // 映像总大小
+    int64_t extent_offset;  // 溢出区段节点表偏移, 位于索引节点表与数据区之间
+    int32_t extent_node_count;
+    int32_t reserved;
+} SuperBlock;
+
+// 日志区: 首块为日志头, 其后是按序号连续排列的提交组, 检查点之后从头重新写入
+typedef struct {
+    uint32_t magic;
+    uint32_t seq; // 日志区起始处第一组应有的序号
+} JournalHeader;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;      // 组序号, 逐组加一
+    uint32_t length;   // 其后记录的总字节数
+    uint32_t checksum; // 记录的校验和, 用于识别写了一半的组
+} JournalGroup;
+
+typedef struct {
+    int64_t offset; // 元数据在映像中的偏移
+    int32_t length; // 新内容的字节数, 内容紧随其后并按 8 字节对齐
+    int32_t reserved;
+} JournalRecord;
+
+typedef struct {
+    uint64_t *bitmap;  // 位示图, 每位对应一个块, 1 表示已分配
+    uint64_t *summary; // 摘要位图, 每位对应位示图中的一个字, 1 表示该字已满
+    int block_count;   // 块总数
+    int word_count;    // 位示图字数
+    int hint;          // 空闲块提示, 该块之前的块均已分配
+} DiskSpaceManager;
+
+typedef struct {
+    int enabled;                // 仅持久化映像启用日志
+    int group_size;             // 每组提交的事务数 (-g)
+    int64_t head;               // 下一组写入位置, 相对于日志区首块之后
+    uint32_t seq;               // 下一组的序号
+    char *log;                  // 日志区首块之后内容的副本, 自上次检查点以来落盘的组依次存放, 检查点据此写回
+    int64_t *ranges;            // 当前组内各事务登记的元数据区间, 按 (偏移, 长度) 成对存放
+    int range_count, range_capacity;
+    int64_t group_bound;        // 当前组落盘后大小的上限
+    int group_txns;             // 组内事务数
+    int *freed;                 // 当前组释放的块, 按 (起始块, 块数) 成对存放, 组落盘时才在位示图中清位
+    int freed_count, freed_capacity;
+    DiskSpaceManager *freed_manager; // 上述块所属的空间管理器
+    long commits, flushes, checkpoints;
+} Journal;
+
+// 每个线程各自的当前事务
+typedef struct {
+    int64_t *ranges; // 修改过的元数据区间, 按 (偏移, 长度) 成对存放
+    int range_count, range_capacity;
+} JournalTxn;
+
+typedef struct {
+    int start; // 起始块号
+    int count; // 连续块数
+} Extent;
+
+// 文件的区段超出索引节点内的 MAX_EXTENTS 个时, 其余区段依次存放在溢出节点链中
+// 节点表与索引节点表同属元数据区, 修改经日志落盘
+typedef struct {
+    Extent extents[NODE_EXTENTS];
+    int next; // 下一个节点号加一, 0 表示链尾
+    int reserved;
+} ExtentNode;
+
+typedef struct FileControlBlock {
+    char filename[36];           // 包含扩展名的文件名
+    Extent extents[MAX_EXTENTS]; // 区段表, 按文件内的块顺序排列
+    int extent_count;            // 区段总数, 含溢出节点中的区段
+    int extent_node;             // 第一个溢出区段节点号加一, 0 表示没有溢出
+    int block_count; // 已分配的块数
+    int size;
+    time_t creation_time;
+    FileAttribute attribute;
+    int is_dir; // 是否为目录
+    int parent; // 所在目录的索引节点号, -1 表示根目录
+    int compressed_size; // 数据块中压缩数据的字节数, 0 表示未压缩; size 始终为解压后的大小
+} FileControlBlock; // 即磁盘映像中的索引节点, 文件名为空表示该节点空闲
+
+typedef struct Directory {
+    char dirname[36];
+    FileControlBlock **fcb; // 以名称为键的开放寻址散列表, 文件和子目录共用, 空槽为 NULL
+    int capacity;           // 散列表容量, 2 的幂
+    int file_count;
+    int ino;                  // 目录的索引节点号, 根目录为 -1
+    struct Directory *parent; // 上级目录, 根目录为 NULL
+    pthread_rwlock_t lock;    // 保护散列表, 查找持读锁, 增删表项持写锁
+    int removed;              // 已被删除, 持有其指针的线程加锁后须先检查
+    struct Directory *next_retired;
+} Directory;
+
+// 目录项缓存: 以 (起始目录, 目录路径) 为键缓存解析结果, 重复解析深层路径时不必逐级查找
+// 目录被删除、重命名或移动时整体失效
+typedef struct {
+    Directory *start;
+    char path[MAX_PATH];
+    Directory *dir;
+    unsigned int generation;
+} DentryCacheEntry;
+
+typedef struct {
+    DentryCacheEntry entries[DCACHE_SIZE];
+    unsigned int generation; // 当前代数, 与之不同的表项视为无效
+    long hits, misses;
+    pthread_mutex_t locks[DCACHE_LOCKS];
+} DentryCache;
+
+typedef struct Buffer {
+    int block;      // 缓存的块号, -1 表示空闲
+    int dirty;      // 是否已修改, 淘汰或刷新时写回
+    int referenced; // CLOCK 访问位
+    struct Buffer *hash_next;
+    char data[BLOCK_SIZE];
+} Buffer;
+
+typedef struct {
+    Buffer buffers[CACHE_BUFFERS / CACHE_SHARDS];
+    Buffer *hash[CACHE_HASH]; // 按块号散列的缓冲链
+    int hand;                 // CLOCK 指针
+    long hits, misses;        // 命中/缺失次数
+    long readaheads;          // 预读的块数
+    long writebacks;          // 写回的块数
+    pthread_mutex_t lock;
+} BufferCache; // 缓存的一个分片
+
+// 块去重: 内容相同的块只存一份, 由引用它的各文件共享, 写入共享块前先复制 (写时复制)
+typedef struct {
+    int *refs;              // 每块的引用计数, 为 NULL 时未启用去重
+    uint64_t *fingerprints; // 每块内容的指纹, 仅对已编入索引的块有意义
+    int *index;             // 指纹 -> 块号的开放寻址散列表, 空槽为 -1
+    int index_mask;
+    long lookups, hits;     // 查重次数与命中次数
+    pthread_mutex_t lock;   // 保护以上各项
+} DedupIndex;
+
+typedef enum {
+    SCHED_FCFS,
+    SCHED_SSTF,
+    SCHED_SCAN,
+    SCHED_CSCAN
+} SchedPolicy;
+
+typedef struct {
+    int track; // 首块所在磁道
+    int count; // 连续块数
+    int write;
+    long id;   // 提交序号
+} DiskRequest;
+
+typedef struct {
+    int enabled;                   // 是否模拟磁盘 (-s)
+    SchedPolicy policy;
+    int blocks_per_track;
+    DiskRequest queue[DISK_QUEUE]; // 待服务的请求, 按提交顺序排列
+    int length;
+    int head;                      // 磁头所在磁道
+    int direction;                 // SCAN 的移动方向, 1 为磁道号增大
+    long next_id;
+    long clock_us;                 // 模拟时钟(微秒)
+    long requests, tracks;         // 已服务的请求数与横跨的总磁道数
+    pthread_mutex_t lock;
+} SimDisk;
+
+typedef struct {
+    FileControlBlock *fcb; // 打开的文件, NULL 表示句柄空闲
+    int flags;             // O_RDONLY / O_WRONLY / O_RDWR
+    int offset;            // file_read/file_write 的当前位置
+    char path[MAX_PATH];   // 打开时的路径, 用于同步宿主文件
+} FileHandle;
+
+char *disk_image = NULL;              // 映射到内存的磁盘映像
+int image_fd = -1;                    // 映像文件描述符, 未指定映像文件时为 -1
+SuperBlock *super_block = NULL;       // 映像中的超级块
+FileControlBlock *inode_table = NULL; // 映像中的索引节点表
+char *disk_memory = NULL;             // 映像中的数据区
+const char *disk_view = NULL;         // 数据区的只读映射, 零拷贝读取返回的视图指向这里
+int *free_inodes = NULL;              // 空闲索引节点栈
+ExtentNode *extent_nodes = NULL;      // 映像中的溢出区段节点表
+int *free_nodes = NULL;               // 空闲溢出节点栈, 挂载时由各文件的节点链推算
+int free_node_count = 0;
+int free_inode_count = 0;
+int host_mirror = 1; // 是否在宿主文件系统上同步创建/删除/重命名文件 (-n 关闭)
+int pread_backend = 0; // 数据块经 pread/pwrite 读写映像文件而不经内存映射 (-p)
+BufferCache cache[CACHE_SHARDS];
+Journal journal;
+__thread JournalTxn txn;
+Directory *root_dir = NULL;         // 根目录
+Directory **directory_table = NULL; // 按索引节点号索引的目录对象, 非目录为 NULL
+Directory *retired_dirs = NULL;     // 已删除的目录对象, 其他线程可能仍持有其指针, 卸载时才释放
+DentryCache dcache;
+__thread FileControlBlock *last_read_fcb = NULL; // 本线程上一次读取的文件及结束位置, 用于识别顺序读
+__thread int last_read_end = 0;
+FileHandle open_files[MAX_OPEN_FILES]; // 文件句柄表, 以下标作为句柄号
+int dedup_enabled = 0;                 // 新建文件时按块查重 (-D)
+DedupIndex dedup;
+time_t *last_access = NULL; // 各索引节点最近一次读写的时间, 用于挑选冷文件压缩
+int *open_counts = NULL;    // 各索引节点的打开句柄数, 只在内存中, 持索引节点锁读写
+SimDisk sim_disk;
+__thread long io_wait_us = 0; // 本线程等待模拟磁盘的累计时间(微秒)
+const char *sched_names[] = {"FCFS", "SSTF", "SCAN", "CSCAN"};
+int random_placement = 0; // 分配块时从随机位置开始查找, 与默认的顺序放置对比
+
+// 插桩计数器, 每个线程各一份, 无需同步; 回归基准在主线程中运行, 只读主线程的值
+__thread long bitmap_scans = 0; // 位示图查找次数
+__thread long bitmap_words = 0; // 查找时读取的位示图字与摘要字数
+__thread long block_allocs = 0; // 分配的块数
+
+// 加锁顺序: meta_lock(读) -> rename_lock -> 目录锁 (两个目录按地址顺序) -> 索引节点锁 -> 其余互斥锁
+// 元数据操作在释放 meta_lock(读) 之前提交事务 (取 journal_lock); 组落盘先以写方式取 meta_lock 再取 journal_lock
+pthread_rwlock_t meta_lock;          // 修改元数据的操作以读方式持有直到提交, 日志组落盘时以写方式持有
+pthread_rwlock_t *inode_locks = NULL; // 每个索引节点一把读写锁, 保护文件的区段表和数据
+pthread_mutex_t free_inode_lock = PTHREAD_MUTEX_INITIALIZER; // 保护空闲索引节点栈
+pthread_mutex_t free_node_lock = PTHREAD_MUTEX_INITIALIZER;  // 保护空闲溢出节点栈
+pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;    // 保护当前组与日志区
+pthread_mutex_t rename_lock = PTHREAD_MUTEX_INITIALIZER;     // 串行化移动操作, 使环路检查不受并发移动干扰
+pthread_mutex_t open_files_lock = PTHREAD_MUTEX_INITIALIZER; // 保护句柄表的分配与释放及各句柄的当前位置
+
+// 记录当前事务修改了映像中的一段元数据, 组落盘时再取其最新内容写入日志
+void journal_dirty(void *addr, int length) {
+    if (!journal.enabled)
+        return;
+    int64_t offset = (char *)addr - disk_image;
+    int64_t *last = txn.range_count ? &txn.ranges[2 * (txn.range_count - 1)] : NULL;
+    if (last && offset >= last[0] && offset <= last[0] + last[1]) { // 与上一区间相接时合并
+        if (offset + length > last[0] + last[1]) {
+            last[1] = offset + length - last[0];
+        }
+        return;
+    }
+    if (txn.range_count == txn.range_capacity) {
+        txn.range_capacity = txn.range_capacity ? txn.range_capacity * 2 : 64;
+        txn.ranges = (int64_t *)realloc(txn.ranges, 2 * txn.range_capacity * sizeof(int64_t));
+    }
+    txn.ranges[2 * txn.range_count] = offset;
+    txn.ranges[2 * txn.range_count + 1] = length;
+    txn.range_count++;
+}
+
+// 位示图以原子操作读写, 多个线程可以同时分配和释放块而无需加锁
+
+// 置位/清位后同步摘要位图; 其他线程可能同时修改同一字, 写入摘要后重新检查, 直到与位示图一致
+static void update_summary(DiskSpaceManager *manager, int word) {
+    uint64_t *summary = &manager->summary[word / WORD_BITS];
+    uint64_t bit = 1ULL << (word % WORD_BITS);
+    int full;
+    do {
+        full = __atomic_load_n(&manager->bitmap[word], __ATOMIC_ACQUIRE) == ~0ULL;
+        if (full) {
+            __atomic_fetch_or(summary, bit, __ATOMIC_ACQ_REL);
+        } else {
+            __atomic_fetch_and(summary, ~bit, __ATOMIC_ACQ_REL);
+        }
+    } while ((__atomic_load_n(&manager->bitmap[word], __ATOMIC_ACQUIRE) == ~0ULL) != full);
+}
+
+// 区间 [i, end) 落在 i 所在字中的部分的掩码, 其块数写入 n
+static uint64_t word_mask(int i, int end, int *n) {
+    int bit = i % WORD_BITS;
+    *n = WORD_BITS - bit < end - i ? WORD_BITS - bit : end - i;
+    return (*n == WORD_BITS ? ~0ULL : ((1ULL << *n) - 1)) << bit;
+}
+
+static void release_blocks(DiskSpaceManager *manager, int start, int count) {
+    int n;
+    for (int i = start; i < start + count; i += n) {
+        int word = i / WORD_BITS;
+        __atomic_fetch_and(&manager->bitmap[word], ~word_mask(i, start + count, &n), __ATOMIC_ACQ_REL);
+        update_summary(manager, word);
+        journal_dirty(&manager->bitmap[word], sizeof(uint64_t));
+    }
+}
+
+// 占用 [start, start + count), 其中有块已被其他线程抢先占用时撤销已置的位并返回 -1
+static int claim_blocks(DiskSpaceManager *manager, int start, int count) {
+    int n;
+    for (int i = start; i < start + count; i += n) {
+        int word = i / WORD_BITS;
+        uint64_t mask = word_mask(i, start + count, &n);
+        uint64_t old = __atomic_load_n(&manager->bitmap[word], __ATOMIC_ACQUIRE);
+        do {
+            if (old & mask) {
+                release_blocks(manager, start, i - start);
+                return -1;
+            }
+        } while (!__atomic_compare_exchange_n(&manager->bitmap[word], &old, old | mask, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+        update_summary(manager, word);
+        journal_dirty(&manager->bitmap[word], sizeof(uint64_t));
+    }
+    COUNT(block_allocs, count);
+    if (dedup.refs) {
+        for (int i = start; i < start + count; ++i) {
+            dedup.refs[i] = 1;
+        }
+    }
+    return 0;
+}
+
+// 查找 from 之后第一个空闲块, 借助摘要位图跳过已满的字
+static int find_free(DiskSpaceManager *manager, int from) {
+    int word = from / WORD_BITS;
+    COUNT(bitmap_scans, 1);
+    if (word >= manager->word_count) {
+        return -1;
+    }
+    COUNT(bitmap_words, 1);
+    uint64_t free_bits = ~__atomic_load_n(&manager->bitmap[word], __ATOMIC_RELAXED) & (~0ULL << (from % WORD_BITS));
+    if (free_bits) {
+        return word * WORD_BITS + __builtin_ctzll(free_bits);
+    }
+    int summary_words = (manager->word_count + WORD_BITS - 1) / WORD_BITS;
+    for (int s = (word + 1) / WORD_BITS; s < summary_words; ++s) {
+        uint64_t candidates = ~__atomic_load_n(&manager->summary[s], __ATOMIC_RELAXED);
+        COUNT(bitmap_words, 1);
+        if (s == (word + 1) / WORD_BITS) {
+            candidates &= ~0ULL << ((word + 1) % WORD_BITS);
+        }
+        for (; candidates; candidates &= candidates - 1) {
+            int w = s * WORD_BITS + __builtin_ctzll(candidates);
+            if (w >= manager->word_count) {
+                return -1;
+            }
+            free_bits = ~__atomic_load_n(&manager->bitmap[w], __ATOMIC_RELAXED);
+            COUNT(bitmap_words, 1);
+            if (free_bits) { // 摘要可能尚未跟上并发的修改, 以位示图为准
+                return w * WORD_BITS + __builtin_ctzll(free_bits);
+            }
+        }
+    }
+    return -1;
+}
+
+// 查找 from 之后第一个已分配块, 全空闲的字整字跳过
+static int find_used(DiskSpaceManager *manager, int from) {
+    int word = from / WORD_BITS;
+    COUNT(bitmap_scans, 1);
+    if (word >= manager->word_count) {
+        return manager->block_count;
+    }
+    uint64_t used_bits = __atomic_load_n(&manager->bitmap[word], __ATOMIC_RELAXED) & (~0ULL << (from % WORD_BITS));
+    COUNT(bitmap_words, 1);
+    while (!used_bits) {
+        if (++word >= manager->word_count) {
+            return manager->block_count;
+        }
+        used_bits = __atomic_load_n(&manager->bitmap[word], __ATOMIC_RELAXED);
+        COUNT(bitmap_words, 1);
+    }
+    int block = word * WORD_BITS + __builtin_ctzll(used_bits);
+    return block < manager->block_count ? block : manager->block_count;
+}
+
+// 位示图位于磁盘映像中, 摘要位图和空闲块提示在挂载时重建
+void init_disk_space_manager(DiskSpaceManager *manager, uint64_t *bitmap, int block_count) {
+    manager->bitmap = bitmap;
+    manager->block_count = block_count;
+    manager->word_count = (block_count + WORD_BITS - 1) / WORD_BITS;
+    manager->summary = (uint64_t *)calloc((manager->word_count + WORD_BITS - 1) / WORD_BITS, sizeof(uint64_t));
+    if (!manager->summary) {
+        perror("位示图分配失败");
+        exit(1);
+    }
+    // 末尾不足一个字的部分视为已分配, 扫描时无需再判断越界
+    if (block_count % WORD_BITS) {
+        manager->bitmap[manager->word_count - 1] |= ~0ULL << (block_count % WORD_BITS);
+    }
+    for (int i = 0; i < manager->word_count; ++i) {
+        update_summary(manager, i);
+    }
+    manager->hint = 0;
+    int first = find_free(manager, 0);
+    manager->hint = first == -1 ? block_count : first;
+}
+
+// 并发分配与释放交错时空闲块提示可能偏大, 提示之后找不到时再从头查找一次
+static int find_free_from_hint(DiskSpaceManager *manager, int hint) {
+    int block = find_free(manager, hint);
+    return block == -1 && hint > 0 ? find_free(manager, 0) : block;
+}
+
+// 分配后推进提示, 其间提示已被其他线程改动时保留对方的值
+static void advance_hint(DiskSpaceManager *manager, int old, int hint) {
+    __atomic_compare_exchange_n(&manager->hint, &old, hint, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+static void lower_hint(DiskSpaceManager *manager, int block) {
+    int hint = __atomic_load_n(&manager->hint, __ATOMIC_RELAXED);
+    while (block < hint && !__atomic_compare_exchange_n(&manager->hint, &hint, block, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+// 查找空闲块的起点: 默认为空闲块提示, 随机放置时为随机块号
+static int search_start(DiskSpaceManager *manager) {
+    return random_placement ? rand() % manager->block_count : __atomic_load_n(&manager->hint, __ATOMIC_RELAXED);
+}
+
+int allocate_block(DiskSpaceManager *manager) {
+    for (;;) {
+        int hint = search_start(manager);
+        int block = find_free_from_hint(manager, hint);
+        if (block == -1)
+            return -1;
+        if (claim_blocks(manager, block, 1) == 0) {
+            advance_hint(manager, hint, block + 1);
+            return block;
+        }
+    }
+}
+
+// 查找 from 之后第一段至少 count 块的连续空闲区
+static int find_run(DiskSpaceManager *manager, int from, int count) {
+    int start = find_free(manager, from);
+    while (start != -1) {
+        int end = find_used(manager, start);
+        if (end - start >= count)
+            return start;
+        start = find_free(manager, end);
+    }
+    return -1;
+}
+
+// 分配 count 个连续块, 返回起始块号, 没有足够长的连续空闲区时返回 -1
+int allocate_blocks(DiskSpaceManager *manager, int count) {
+    for (;;) {
+        int hint = search_start(manager);
+        int first = find_free_from_hint(manager, hint);
+        int start = first == -1 ? -1 : find_run(manager, first, count);
+        if (start == -1 && first > 0) {
+            start = find_run(manager, 0, count);
+        }
+        if (start == -1)
+            return -1;
+        if (claim_blocks(manager, start, count) == 0) {
+            if (start == first) {
+                advance_hint(manager, hint, start + count);
+            }
+            return start;
+        }
+    }
+}
+
+// 块内容的指纹, 每次处理 8 字节
+static uint64_t fingerprint(const char *data) {
+    uint64_t h = 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < BLOCK_SIZE; i += 8) {
+        uint64_t w;
+        memcpy(&w, data + i, 8);
+        h = (h ^ w) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+    }
+    return h;
+}
+
+// 以下去重索引函数须持有 dedup.lock
+static int dedup_find(uint64_t fp) {
+    for (int i = fp & dedup.index_mask; dedup.index[i] != -1; i = (i + 1) & dedup.index_mask) {
+        if (dedup.fingerprints[dedup.index[i]] == fp)
+            return i;
+    }
+    return -1;
+}
+
+// 登记块的指纹, 已有相同指纹的块时不登记
+static void dedup_add(int block, uint64_t fp) {
+    int i = fp & dedup.index_mask;
+    while (dedup.index[i] != -1) {
+        if (dedup.fingerprints[dedup.index[i]] == fp)
+            return;
+        i = (i + 1) & dedup.index_mask;
+    }
+    dedup.fingerprints[block] = fp;
+    dedup.index[i] = block;
+}
+
+// 块被释放或即将被改写时撤销其登记, 删除方式同目录散列表
+static void dedup_remove(int block) {
+    int i = dedup_find(dedup.fingerprints[block]);
+    if (i == -1 || dedup.index[i] != block)
+        return;
+    int j = i;
+    dedup.index[i] = -1;
+    while (dedup.index[j = (j + 1) & dedup.index_mask] != -1) {
+        int home = dedup.fingerprints[dedup.index[j]] & dedup.index_mask;
+        if ((j > i && (home <= i || home > j)) || (j < i && home <= i && home > j)) {
+            dedup.index[i] = dedup.index[j];
+            dedup.index[j] = -1;
+            i = j;
+        }
+    }
+}
+
+// 把块交还分配器: 未启用日志时立即清位; 启用日志时记入当前组, 留到组落盘时才清位
+// 释放块的节点修改落盘之前块不会被再次分配, 崩溃后重放出的旧节点所指的数据不会已被其他文件改写
+static void retire_blocks(DiskSpaceManager *manager, int start, int count) {
+    if (!journal.enabled) {
+        release_blocks(manager, start, count);
+        lower_hint(manager, start);
+        return;
+    }
+    pthread_mutex_lock(&journal_lock);
+    int *last = journal.freed_count ? &journal.freed[2 * (journal.freed_count - 1)] : NULL;
+    if (last && last[0] + last[1] == start) {
+        last[1] += count;
+    } else {
+        if (journal.freed_count == journal.freed_capacity) {
+            journal.freed_capacity = journal.freed_capacity ? journal.freed_capacity * 2 : 64;
+            journal.freed = (int *)realloc(journal.freed, 2 * journal.freed_capacity * sizeof(int));
+        }
+        journal.freed[2 * journal.freed_count] = start;
+        journal.freed[2 * journal.freed_count + 1] = count;
+        journal.freed_count++;
+    }
+    journal.freed_manager = manager;
+    pthread_mutex_unlock(&journal_lock);
+}
+
+// 释放块; 启用去重时只减少引用计数, 最后一个引用消失时才真正释放
+void free_blocks(DiskSpaceManager *manager, int start, int count) {
+    if (dedup.refs) {
+        pthread_mutex_lock(&dedup.lock);
+        for (int i = start; i < start + count; ++i) {
+            if (--dedup.refs[i] == 0) {
+                dedup_remove(i);
+                retire_blocks(manager, i, 1);
+            }
+        }
+        pthread_mutex_unlock(&dedup.lock);
+    } else {
+        retire_blocks(manager, start, count);
+    }
+}
+
+void free_block(DiskSpaceManager *manager, int block_index) {
+    free_blocks(manager, block_index, 1);
+}
+
+// 分配一个区段: 优先从 goal 处接续, 其次整段连续分配, 最后退而取最长的空闲段
+// 返回起始块号, 实际分配的块数写入 got
+int allocate_extent(DiskSpaceManager *manager, int goal, int want, int *got) {
+    if (goal >= 0 && find_free(manager, goal) == goal) {
+        int run = find_used(manager, goal) - goal;
+        int n = run < want ? run : want;
+        if (claim_blocks(manager, goal, n) == 0) {
+            *got = n;
+            return goal;
+        }
+    }
+    int start = allocate_blocks(manager, want);
+    if (start != -1) {
+        *got = want;
+        return start;
+    }
+    for (;;) {
+        int best = -1, best_len = 0;
+        for (int i = find_free(manager, 0); i != -1;) {
+            int end = find_used(manager, i);
+            if (end - i > best_len) {
+                best = i;
+                best_len = end - i;
+            }
+            i = find_free(manager, end);
+        }
+        if (best == -1)
+            return -1;
+        *got = best_len < want ? best_len : want;
+        if (claim_blocks(manager, best, *got) == 0)
+            return best;
+    }
+}
+
+static unsigned int hash_name(const char *name) {
+    unsigned int h = 2166136261u; // FNV-1a
+    while (*name) {
+        h = (h ^ (unsigned char)*name++) * 16777619u;
+    }
+    return h;
+}
+
+void init_directory(Directory *dir, const char *dirname) {
+    strcpy(dir->dirname, dirname);
+    dir->capacity = DIR_INIT_CAPACITY;
+    dir->fcb = (FileControlBlock **)calloc(dir->capacity, sizeof(FileControlBlock *));
+    dir->file_count = 0;
+    dir->ino = -1;
+    dir->parent = NULL;
+    pthread_rwlock_init(&dir->lock, NULL);
+    dir->removed = 0;
+    dir->next_retired = NULL;
+}
+
+void destroy_directory(Directory *dir) {
+    pthread_rwlock_destroy(&dir->lock);
+    free(dir->fcb);
+    free(dir);
+}
+
+// 以写方式锁住两个目录, 按地址顺序加锁以免死锁, b 可以为 NULL 或与 a 相同
+static void lock_directories(Directory *a, Directory *b) {
+    if (b && b != a && b < a) {
+        pthread_rwlock_wrlock(&b->lock);
+        b = NULL;
+    }
+    pthread_rwlock_wrlock(&a->lock);
+    if (b && b != a) {
+        pthread_rwlock_wrlock(&b->lock);
+    }
+}
+
+static void unlock_directories(Directory *a, Directory *b) {
+    if (b && b != a) {
+        pthread_rwlock_unlock(&b->lock);
+    }
+    pthread_rwlock_unlock(&a->lock);
+}
+
+// 返回文件名所在的槽位, 不存在时返回应插入的空槽
+static int dir_slot(Directory *dir, const char *filename) {
+    int mask = dir->capacity - 1;
+    int i = hash_name(filename) & mask;
+    while (dir->fcb[i] && strcmp(dir->fcb[i]->filename, filename) != 0) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static void dir_insert(Directory *dir, FileControlBlock *fcb) {
+    if ((dir->file_count + 1) * 4 > dir->capacity * 3) { // 装载因子超过 3/4 时扩容
+        FileControlBlock **old = dir->fcb;
+        int old_capacity = dir->capacity;
+        dir->capacity *= 2;
+        dir->fcb = (FileControlBlock **)calloc(dir->capacity, sizeof(FileControlBlock *));
+        for (int i = 0; i < old_capacity; ++i) {
+            if (old[i]) {
+                dir->fcb[dir_slot(dir, old[i]->filename)] = old[i];
+            }
+        }
+        free(old);
+    }
+    dir->fcb[dir_slot(dir, fcb->filename)] = fcb;
+    dir->file_count++;
+}
+
+// 删除槽位 i 的表项, 并把后续探测链上的表项前移以保持可查找
+static void dir_remove_slot(Directory *dir, int i) {
+    int mask = dir->capacity - 1;
+    int j = i;
+    dir->fcb[i] = NULL;
+    while (dir->fcb[j = (j + 1) & mask]) {
+        int home = hash_name(dir->fcb[j]->filename) & mask;
+        // home 不在 (i, j] 之间时, 该表项可以移到空出的槽位 i
+        if ((j > i && (home <= i || home > j)) || (j < i && home <= i && home > j)) {
+            dir->fcb[i] = dir->fcb[j];
+            dir->fcb[j] = NULL;
+            i = j;
+        }
+    }
+    dir->file_count--;
+}
+
+// 模拟磁盘: 块存储的每次读写都作为请求提交到磁道请求队列, 按 disk.c 中的调度算法服务, 并推进模拟时钟
+// 写请求排队异步完成, 队列满时先服务掉一个; 读请求同步, 一直调度到它被服务为止
+static int disk_pick() {
+    int best = 0;
+    switch (sim_disk.policy) {
+    case SCHED_FCFS: // 队列按提交顺序排列
+        return 0;
+    case SCHED_SSTF: // 同 Smin: 离磁头最近的请求
+        for (int i = 1; i < sim_disk.length; ++i) {
+            if (abs(sim_disk.queue[i].track - sim_disk.head) < abs(sim_disk.queue[best].track - sim_disk.head)) {
+                best = i;
+            }
+        }
+        return best;
+    case SCHED_SCAN: // 沿当前方向取最近的请求, 该方向上没有请求时掉头
+        for (;;) {
+            best = -1;
+            for (int i = 0; i < sim_disk.length; ++i) {
+                int d = (sim_disk.queue[i].track - sim_disk.head) * sim_disk.direction;
+                if (d >= 0 && (best == -1 || d < (sim_disk.queue[best].track - sim_disk.head) * sim_disk.direction)) {
+                    best = i;
+                }
+            }
+            if (best != -1)
+                return best;
+            sim_disk.direction = -sim_disk.direction;
+        }
+    case SCHED_CSCAN: // 只向磁道号增大的方向服务, 前方没有请求时回到磁道号最小的请求
+        best = -1;
+        for (int i = 0; i < sim_disk.length; ++i) {
+            int track = sim_disk.queue[i].track;
+            if (track >= sim_disk.head && (best == -1 || track < sim_disk.queue[best].track)) {
+                best = i;
+            }
+        }
+        if (best != -1)
+            return best;
+        best = 0;
+        for (int i = 1; i < sim_disk.length; ++i) {
+            if (sim_disk.queue[i].track < sim_disk.queue[best].track) {
+                best = i;
+            }
+        }
+        return best;
+    }
+    return 0;
+}
+
+// 服务一个请求: 移动磁头并推进模拟时钟, 返回该请求的编号; 调用者持有 sim_disk.lock
+static long disk_service() {
+    int i = disk_pick();
+    DiskRequest request = sim_disk.queue[i];
+    memmove(&sim_disk.queue[i], &sim_disk.queue[i + 1], (sim_disk.length - i - 1) * sizeof(DiskRequest));
+    sim_disk.length--;
+    int distance = abs(request.track - sim_disk.head);
+    long cost = (distance ? SEEK_START_US + distance * SEEK_TRACK_US : 0) + request.count * TRANSFER_US;
+    sim_disk.head = request.track;
+    sim_disk.clock_us += cost;
+    sim_disk.tracks += distance;
+    sim_disk.requests++;
+    io_wait_us += cost;
+    return request.id;
+}
+
+static void disk_submit(int block, int count, int write) {
+    if (!sim_disk.enabled)
+        return;
+    pthread_mutex_lock(&sim_disk.lock);
+    while (sim_disk.length == DISK_QUEUE) {
+        disk_service();
+    }
+    long id = sim_disk.next_id++;
+    sim_disk.queue[sim_disk.length++] = (DiskRequest){block / sim_disk.blocks_per_track, count, write, id};
+    if (!write) {
+        while (disk_service() != id)
+            ;
+    }
+    pthread_mutex_unlock(&sim_disk.lock);
+}
+
+// 服务完队列中的所有请求, 刷新缓存后调用
+void disk_drain() {
+    if (!sim_disk.enabled)
+        return;
+    pthread_mutex_lock(&sim_disk.lock);
+    while (sim_disk.length) {
+        disk_service();
+    }
+    pthread_mutex_unlock(&sim_disk.lock);
+}
+
+void disk_init(int block_count, SchedPolicy policy) {
+    memset(&sim_disk, 0, sizeof(sim_disk));
+    pthread_mutex_init(&sim_disk.lock, NULL);
+    sim_disk.enabled = 1;
+    sim_disk.policy = policy;
+    sim_disk.blocks_per_track = (block_count + DISK_TRACKS - 1) / DISK_TRACKS;
+    sim_disk.direction = 1;
+}
+
+void display_disk_stats() {
+    if (!sim_disk.enabled)
+        return;
+    printf("模拟磁盘(%s): 服务请求 %ld, 横跨磁道 %ld, 平均寻道长度 %.2f, 模拟耗时 %.3f 秒\n",
+           sched_names[sim_disk.policy], sim_disk.requests, sim_disk.tracks,
+           sim_disk.requests ? 1.0 * sim_disk.tracks / sim_disk.requests : 0.0, sim_disk.clock_us / 1e6);
+}
+
+// 块存储: 数据区中连续 count 块的读写, 缓冲区缓存之下的唯一数据通路
+static void store_read(int block, char *buf, int count) {
+    disk_submit(block, count, 0);
+    if (!pread_backend) {
+        memcpy(buf, disk_memory + (size_t)block * BLOCK_SIZE, (size_t)count * BLOCK_SIZE);
+    } else if (pread(image_fd, buf, (size_t)count * BLOCK_SIZE, super_block->data_offset + (off_t)block * BLOCK_SIZE) < 0) {
+        perror("读取磁盘映像失败");
+    }
+}
+
+static void store_write(int block, const char *buf, int count) {
+    disk_submit(block, count, 1);
+    if (!pread_backend) {
+        memcpy(disk_memory + (size_t)block * BLOCK_SIZE, buf, (size_t)count * BLOCK_SIZE);
+    } else if (pwrite(image_fd, buf, (size_t)count * BLOCK_SIZE, super_block->data_offset + (off_t)block * BLOCK_SIZE) < 0) {
+        perror("写入磁盘映像失败");
+    }
+}
+
+static void store_zero(int block, int count) {
+    static const char zero[BLOCK_SIZE];
+    if (!pread_backend) {
+        disk_submit(block, count, 1);
+        memset(disk_memory + (size_t)block * BLOCK_SIZE, 0, (size_t)count * BLOCK_SIZE);
+        return;
+    }
+    for (int i = 0; i < count; ++i) {
+        store_write(block + i, zero, 1);
+    }
+}
+
+void cache_init() {
+    for (int s = 0; s < CACHE_SHARDS; ++s) {
+        memset(&cache[s], 0, sizeof(cache[s]));
+        pthread_mutex_init(&cache[s].lock, NULL);
+        for (int i = 0; i < CACHE_BUFFERS / CACHE_SHARDS; ++i) {
+            cache[s].buffers[i].block = -1;
+        }
+    }
+}
+
+// 块所在的缓存分片, 调用下面的 bread/bget 前须持有分片的锁
+static BufferCache *cache_shard(int block) {
+    return &cache[block % CACHE_SHARDS];
+}
+
+static Buffer *cache_lookup(BufferCache *shard, int block) {
+    for (Buffer *b = shard->hash[block % CACHE_HASH]; b; b = b->hash_next) {
+        if (b->block == block)
+            return b;
+    }
+    return NULL;
+}
+
+static void cache_unhash(BufferCache *shard, Buffer *b) {
+    Buffer **pp = &shard->hash[b->block % CACHE_HASH];
+    while (*pp != b) {
+        pp = &(*pp)->hash_next;
+    }
+    *pp = b->hash_next;
+    b->block = -1;
+}
+
+// 按 CLOCK 算法挑选一个缓冲块改为缓存 block, 被淘汰的脏块先写回
+static Buffer *cache_alloc(BufferCache *shard, int block) {
+    Buffer *b;
+    for (;;) {
+        b = &shard->buffers[shard->hand];
+        shard->hand = (shard->hand + 1) % (CACHE_BUFFERS / CACHE_SHARDS);
+        if (b->block == -1 || !b->referenced)
+            break;
+        b->referenced = 0;
+    }
+    if (b->block != -1) {
+        if (b->dirty) {
+            store_write(b->block, b->data, 1);
+            shard->writebacks++;
+        }
+        cache_unhash(shard, b);
+    }
+    b->block = block;
+    b->dirty = 0;
+    b->referenced = 1;
+    b->hash_next = shard->hash[block % CACHE_HASH];
+    shard->hash[block % CACHE_HASH] = b;
+    return b;
+}
+
+// 读取一个块的缓冲
+Buffer *bread(int block) {
+    BufferCache *shard = cache_shard(block);
+    Buffer *b = cache_lookup(shard, block);
+    if (b) {
+        shard->hits++;
+        b->referenced = 1;
+        return b;
+    }
+    shard->misses++;
+    b = cache_alloc(shard, block);
+    store_read(block, b->data, 1);
+    return b;
+}
+
+// 取得一个块的缓冲但不读入内容, 用于整块覆盖写
+Buffer *bget(int block) {
+    BufferCache *shard = cache_shard(block);
+    Buffer *b = cache_lookup(shard, block);
+    if (b) {
+        b->referenced = 1;
+        return b;
+    }
+    return cache_alloc(shard, block);
+}
+
+static int cache_contains(int block) {
+    BufferCache *shard = cache_shard(block);
+    pthread_mutex_lock(&shard->lock);
+    int found = cache_lookup(shard, block) != NULL;
+    pthread_mutex_unlock(&shard->lock);
+    return found;
+}
+
+// 把 [start, start + count) 中未缓存的块读入缓存, 连续缺失的块合并为一次读取
+// 读入期间被其他线程缓存的块以缓存中的为准
+void cache_readahead(int start, int count) {
+    char run[CACHE_BUFFERS / 2 * BLOCK_SIZE];
+    if (count > CACHE_BUFFERS / 2)
+        count = CACHE_BUFFERS / 2;
+    int i = 0;
+    while (i < count) {
+        if (cache_contains(start + i)) {
+            i++;
+            continue;
+        }
+        int n = 1;
+        while (i + n < count && !cache_contains(start + i + n)) {
+            n++;
+        }
+        store_read(start + i, run, n);
+        for (int j = 0; j < n; ++j) {
+            BufferCache *shard = cache_shard(start + i + j);
+            pthread_mutex_lock(&shard->lock);
+            if (!cache_lookup(shard, start + i + j)) {
+                Buffer *b = cache_alloc(shard, start + i + j);
+                memcpy(b->data, run + j * BLOCK_SIZE, BLOCK_SIZE);
+                b->referenced = 0; // 预读的块尚未被访问, 可优先淘汰
+                shard->readaheads++;
+            }
+            pthread_mutex_unlock(&shard->lock);
+        }
+        i += n;
+    }
+}
+
+// 丢弃已释放块的缓冲, 脏数据不再写回
+void cache_invalidate(int start, int count) {
+    for (int s = 0; s < CACHE_SHARDS; ++s) {
+        BufferCache *shard = &cache[s];
+        pthread_mutex_lock(&shard->lock);
+        if (count > CACHE_BUFFERS) {
+            for (int i = 0; i < CACHE_BUFFERS / CACHE_SHARDS; ++i) {
+                Buffer *b = &shard->buffers[i];
+                if (b->block >= start && b->block < start + count) {
+                    cache_unhash(shard, b);
+                }
+            }
+        } else {
+            for (int block = start + (s - start % CACHE_SHARDS + CACHE_SHARDS) % CACHE_SHARDS; block < start + count; block += CACHE_SHARDS) {
+                Buffer *b = cache_lookup(shard, block);
+                if (b) {
+                    cache_unhash(shard, b);
+                }
+            }
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+// 把 [start, start + count) 中的脏块写回块存储, 缓冲保留在缓存中
+void cache_writeback(int start, int count) {
+    for (int block = start; block < start + count; ++block) {
+        BufferCache *shard = cache_shard(block);
+        pthread_mutex_lock(&shard->lock);
+        Buffer *b = cache_lookup(shard, block);
+        if (b && b->dirty) {
+            store_write(block, b->data, 1);
+            b->dirty = 0;
+            shard->writebacks++;
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+static int compare_buffer_block(const void *a, const void *b) {
+    return (*(Buffer **)a)->block - (*(Buffer **)b)->block;
+}
+
+// 按块号顺序写回所有脏块, 块号连续的脏块合并为一次写入; 期间持有所有分片的锁
+void cache_flush() {
+    static char run[CACHE_BUFFERS * BLOCK_SIZE];
+    Buffer *dirty[CACHE_BUFFERS];
+    int n = 0;
+    for (int s = 0; s < CACHE_SHARDS; ++s) {
+        pthread_mutex_lock(&cache[s].lock);
+        for (int i = 0; i < CACHE_BUFFERS / CACHE_SHARDS; ++i) {
+            if (cache[s].buffers[i].block != -1 && cache[s].buffers[i].dirty) {
+                dirty[n++] = &cache[s].buffers[i];
+                cache[s].writebacks++;
+            }
+        }
+    }
+    qsort(dirty, n, sizeof(Buffer *), compare_buffer_block);
+    for (int i = 0; i < n;) {
+        int len = 1;
+        while (i + len < n && dirty[i + len]->block == dirty[i]->block + len) {
+            len++;
+        }
+        for (int j = 0; j < len; ++j) {
+            memcpy(run + j * BLOCK_SIZE, dirty[i + j]->data, BLOCK_SIZE);
+            dirty[i + j]->dirty = 0;
+        }
+        store_write(dirty[i]->block, run, len);
+        i += len;
+    }
+    for (int s = CACHE_SHARDS - 1; s >= 0; --s) {
+        pthread_mutex_unlock(&cache[s].lock);
+    }
+    disk_drain();
+}
+
+void display_cache_stats() {
+    long hits = 0, misses = 0, readaheads = 0, writebacks = 0;
+    for (int s = 0; s < CACHE_SHARDS; ++s) {
+        hits += cache[s].hits;
+        misses += cache[s].misses;
+        readaheads += cache[s].readaheads;
+        writebacks += cache[s].writebacks;
+    }
+    long total = hits + misses;
+    printf("缓存统计: 命中 %ld, 缺失 %ld, 命中率 %.2f%%, 预读 %ld 块, 写回 %ld 块\n",
+           hits, misses, total ? 100.0 * hits / total : 0.0, readaheads, writebacks);
+    total = dcache.hits + dcache.misses;
+    printf("目录项缓存: 命中 %ld, 缺失 %ld, 命中率 %.2f%%\n",
+           dcache.hits, dcache.misses, total ? 100.0 * dcache.hits / total : 0.0);
+}
+
+static uint32_t journal_checksum(const char *data, int length) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < length; ++i) {
+        h = (h ^ (unsigned char)data[i]) * 16777619u;
+    }
+    return h;
+}
+
+static int64_t journal_area() {
+    return super_block->journal_size - BLOCK_SIZE;
+}
+
+// 检查点: 把日志区中已落盘的各组按顺序写回元数据原位, 之后日志区可从头复用
+// 写回的是日志中的内容而不是内存中的元数据, 尚未提交的修改不会经检查点到达映像; 调用者持有 journal_lock (挂载和卸载时除外)
+void journal_checkpoint() {
+    for (int64_t pos = 0; pos < journal.head;) {
+        JournalGroup *group = (JournalGroup *)(journal.log + pos);
+        char *records = journal.log + pos + sizeof(JournalGroup);
+        for (uint32_t i = 0; i < group->length;) {
+            JournalRecord *record = (JournalRecord *)(records + i);
+            if (pwrite(image_fd, records + i + sizeof(JournalRecord), record->length, record->offset) != record->length) {
+                perror("写回元数据失败");
+            }
+            i += sizeof(JournalRecord) + (record->length + 7) / 8 * 8;
+        }
+        pos += sizeof(JournalGroup) + group->length;
+    }
+    fdatasync(image_fd);
+    JournalHeader header = {JOURNAL_MAGIC, journal.seq};
+    if (pwrite(image_fd, &header, sizeof(header), super_block->journal_offset) < 0) {
+        perror("写入日志头失败");
+    }
+    fdatasync(image_fd);
+    journal.head = 0;
+    journal.checkpoints++;
+}
+
+static int compare_range(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// 向当前组登记一个区间, 须持有 journal_lock
+static void add_group_range(int64_t offset, int64_t length) {
+    if (journal.range_count == journal.range_capacity) {
+        journal.range_capacity = journal.range_capacity ? journal.range_capacity * 2 : 64;
+        journal.ranges = (int64_t *)realloc(journal.ranges, 2 * journal.range_capacity * sizeof(int64_t));
+    }
+    journal.ranges[2 * journal.range_count] = offset;
+    journal.ranges[2 * journal.range_count + 1] = length;
+    journal.range_count++;
+}
+
+// 合并当前组中已按偏移排序的区间, 相距不超过 gap 字节的合为一个, 返回合并后的区间数
+static int merge_ranges(int count, int64_t gap) {
+    int merged = 0;
+    for (int i = 0; i < count; ++i) {
+        int64_t *range = &journal.ranges[2 * i], *last = &journal.ranges[2 * (merged - 1)];
+        if (merged && range[0] <= last[0] + last[1] + gap) {
+            if (range[0] + range[1] > last[0] + last[1]) {
+                last[1] = range[0] + range[1] - last[0];
+            }
+        } else {
+            journal.ranges[2 * merged] = range[0];
+            journal.ranges[2 * merged + 1] = range[1];
+            merged++;
+        }
+    }
+    return merged;
+}
+
+// 由 count 个区间组成的组写入日志区所占的字节数
+static int64_t group_bytes(int count) {
+    int64_t total = sizeof(JournalGroup);
+    for (int i = 0; i < count; ++i) {
+        total += sizeof(JournalRecord) + (journal.ranges[2 * i + 1] + 7) / 8 * 8;
+    }
+    return total;
+}
+
+// 组提交: 合并组内各事务登记的区间, 取其最新内容作为一组顺序写入日志区并落盘
+// 调用者以写方式持有 meta_lock 并持有 journal_lock, 此时修改过元数据的操作都已把区间登记到本组
+// 日志区剩余空间放不下本组时先做检查点; 组绝不写过日志区末尾, 整个日志区都放不下时本组留待下次落盘
+static void journal_flush_locked() {
+    if (!journal.enabled || journal.group_txns == 0)
+        return;
+    cache_flush(); // 数据块先于引用它们的元数据落盘
+    fdatasync(image_fd);
+    // 本组释放的块所在的位示图字随本组落盘, 确定放得下之后才清位
+    DiskSpaceManager *manager = journal.freed_manager;
+    for (int i = 0; i < journal.freed_count; ++i) {
+        int first = journal.freed[2 * i] / WORD_BITS, last = (journal.freed[2 * i] + journal.freed[2 * i + 1] - 1) / WORD_BITS;
+        add_group_range((char *)&manager->bitmap[first] - disk_image, (int64_t)(last - first + 1) * sizeof(uint64_t));
+    }
+    qsort(journal.ranges, journal.range_count, 2 * sizeof(int64_t), compare_range);
+    int merged = merge_ranges(journal.range_count, 0);
+    int64_t total = group_bytes(merged);
+    // 零碎的小区间每个都要一个记录头, 放不下时逐步放宽合并距离, 用区间之间的元数据换记录头,
+    // 最终合成一个覆盖全部修改的记录; 此时没有进行中的操作, 且操作都在退出前提交, 空隙中的内容也都已提交
+    for (int64_t gap = 64; total > journal_area() && merged > 1; gap *= 8) {
+        merged = merge_ranges(merged, gap);
+        total = group_bytes(merged);
+    }
+    journal.range_count = merged;
+    if (journal.head + total > journal_area()) {
+        journal_checkpoint();
+    }
+    if (total > journal_area()) {
+        fprintf(stderr, "日志区过小, 放不下 %lld 字节的提交组, 元数据暂未落盘\n", (long long)total);
+        return;
+    }
+    // 清位修改的字都已登记在本组, 不再记入落盘线程的事务; 持有 meta_lock 写锁, 组落盘前无人能分配这些块
+    int txn_ranges = txn.range_count;
+    for (int i = 0; i < journal.freed_count; ++i) {
+        release_blocks(manager, journal.freed[2 * i], journal.freed[2 * i + 1]);
+        lower_hint(manager, journal.freed[2 * i]);
+    }
+    txn.range_count = txn_ranges;
+    journal.freed_count = 0;
+    JournalGroup *group = (JournalGroup *)(journal.log + journal.head);
+    char *records = journal.log + journal.head + sizeof(JournalGroup);
+    uint32_t length = 0;
+    for (int i = 0; i < merged; ++i) {
+        JournalRecord record = {journal.ranges[2 * i], (int32_t)journal.ranges[2 * i + 1], 0};
+        memcpy(records + length, &record, sizeof(record));
+        memcpy(records + length + sizeof(record), disk_image + record.offset, record.length);
+        length += sizeof(record) + (record.length + 7) / 8 * 8;
+    }
+    group->magic = JOURNAL_MAGIC;
+    group->seq = journal.seq;
+    group->length = length;
+    group->checksum = journal_checksum(records, length);
+    if (pwrite(image_fd, group, total, super_block->journal_offset + BLOCK_SIZE + journal.head) != total) {
+        perror("写入日志失败");
+    }
+    fdatasync(image_fd);
+    journal.head += total;
+    journal.seq++;
+    journal.range_count = 0;
+    journal.group_bound = 0;
+    journal.group_txns = 0;
+    journal.flushes++;
+    // 日志过半即做检查点, 缩短挂载时的重放
+    if (journal.head > journal_area() / 2) {
+        journal_checkpoint();
+    }
+}
+
+void journal_flush() {
+    if (!journal.enabled)
+        return;
+    pthread_rwlock_wrlock(&meta_lock);
+    pthread_mutex_lock(&journal_lock);
+    journal_flush_locked();
+    pthread_mutex_unlock(&journal_lock);
+    pthread_rwlock_unlock(&meta_lock);
+}
+
+// 提交当前事务: 须在释放 meta_lock 之前调用, 只把修改过的区间登记到当前组, 内容在组落盘时再取
+// 操作释放 meta_lock 前其修改已登记, 组落盘时取到的共享位示图字中不会有未提交事务的修改
+// 返回当前组是否已满, 已满时调用者释放 meta_lock 后应落盘
+int journal_commit() {
+    if (!journal.enabled || txn.range_count == 0)
+        return 0; // 未修改元数据的操作(包括出错提前返回的)不计入组
+    pthread_mutex_lock(&journal_lock);
+    if (journal.range_count + txn.range_count > journal.range_capacity) {
+        journal.range_capacity = (journal.range_count + txn.range_count) * 2;
+        journal.ranges = (int64_t *)realloc(journal.ranges, 2 * journal.range_capacity * sizeof(int64_t));
+    }
+    for (int i = 0; i < txn.range_count; ++i) {
+        journal.ranges[2 * journal.range_count] = txn.ranges[2 * i];
+        journal.ranges[2 * journal.range_count + 1] = txn.ranges[2 * i + 1];
+        journal.range_count++;
+        journal.group_bound += sizeof(JournalRecord) + (txn.ranges[2 * i + 1] + 7) / 8 * 8;
+    }
+    txn.range_count = 0;
+    journal.group_txns++;
+    journal.commits++;
+    int full = journal.group_txns >= journal.group_size || journal.group_bound > journal_area() / 4;
+    pthread_mutex_unlock(&journal_lock);
+    return full;
+}
+
+// 结束一次元数据操作: 仍持有 meta_lock 时提交事务, 释放后若当前组已满则落盘
+void end_metadata_op() {
+    int full = journal_commit();
+    pthread_rwlock_unlock(&meta_lock);
+    if (full) {
+        journal_flush();
+    }
+}
+
+// 挂载时重放日志: 按序号依次应用校验通过的组, 遇到第一个无效组即停止
+// 有效的组保留在 journal.log 中, 随后的检查点据此写回元数据原位
+static void journal_replay() {
+    JournalHeader header;
+    if (pread(image_fd, &header, sizeof(header), super_block->journal_offset) != sizeof(header) ||
+        header.magic != JOURNAL_MAGIC) {
+        header.seq = 1;
+    }
+    journal.seq = header.seq;
+    int64_t pos = 0;
+    int replayed = 0;
+    for (;;) {
+        JournalGroup group;
+        int64_t at = super_block->journal_offset + BLOCK_SIZE + pos;
+        if (pos + (int64_t)sizeof(group) > journal_area() ||
+            pread(image_fd, &group, sizeof(group), at) != sizeof(group) ||
+            group.magic != JOURNAL_MAGIC || group.seq != journal.seq ||
+            pos + (int64_t)sizeof(group) + group.length > journal_area())
+            break;
+        char *payload = journal.log + pos + sizeof(group);
+        if (pread(image_fd, payload, group.length, at + sizeof(group)) != (ssize_t)group.length ||
+            journal_checksum(payload, group.length) != group.checksum)
+            break;
+        for (uint32_t i = 0; i < group.length;) {
+            JournalRecord *record = (JournalRecord *)(payload + i);
+            if (record->offset >= super_block->bitmap_offset &&
+                record->offset + record->length <= super_block->data_offset) {
+                memcpy(disk_image + record->offset, payload + i + sizeof(JournalRecord), record->length);
+            }
+            i += sizeof(JournalRecord) + (record->length + 7) / 8 * 8;
+        }
+        memcpy(journal.log + pos, &group, sizeof(group));
+        pos += sizeof(group) + group.length;
+        journal.seq++;
+        replayed++;
+    }
+    if (replayed) {
+        printf("日志恢复: 重放了 %d 组事务\n", replayed);
+    }
+    journal.head = pos;
+    journal_checkpoint();
+}
+
+void journal_init(int group_size) {
+    free(journal.log);
+    free(journal.ranges);
+    free(journal.freed);
+    free(txn.ranges);
+    memset(&txn, 0, sizeof(txn));
+    memset(&journal, 0, sizeof(journal));
+    journal.group_size = group_size;
+    if (image_fd < 0)
+        return;
+    journal.enabled = 1;
+    journal.log = (char *)malloc(journal_area());
+    journal_replay();
+}
+
+void display_journal_stats() {
+    if (!journal.enabled) {
+        printf("日志未启用(未指定磁盘映像)\n");
+        return;
+    }
+    printf("日志统计: 提交事务 %ld, 落盘组 %ld, 检查点 %ld, 每组事务数 %d\n",
+           journal.commits, journal.flushes, journal.checkpoints, journal.group_size);
+}
+
+FileControlBlock *alloc_inode() {
+    pthread_mutex_lock(&free_inode_lock);
+    FileControlBlock *fcb = free_inode_count ? &inode_table[free_inodes[--free_inode_count]] : NULL;
+    pthread_mutex_unlock(&free_inode_lock);
+    if (fcb) {
+        memset(fcb, 0, sizeof(FileControlBlock));
+    }
+    return fcb;
+}
+
+// 文件的第 i 个区段, 超出索引节点内的区段表时沿溢出节点链查找
+static Extent *file_extent(FileControlBlock *fcb, int i) {
+    if (i < MAX_EXTENTS)
+        return &fcb->extents[i];
+    ExtentNode *node = &extent_nodes[fcb->extent_node - 1];
+    for (i -= MAX_EXTENTS; i >= NODE_EXTENTS; i -= NODE_EXTENTS) {
+        node = &extent_nodes[node->next - 1];
+    }
+    return &node->extents[i];
+}
+
+// 容纳 count 个区段所需的溢出节点数
+static int extent_nodes_for(int count) {
+    return count > MAX_EXTENTS ? (count - MAX_EXTENTS + NODE_EXTENTS - 1) / NODE_EXTENTS : 0;
+}
+
+// 把文件的区段数调整为 count, 溢出节点随之分配或释放; 节点用完时不做修改并返回 -1
+// 新增的区段由调用者填写, 调用者持有索引节点写锁
+static int resize_extents(FileControlBlock *fcb, int count) {
+    int have = extent_nodes_for(fcb->extent_count), need = extent_nodes_for(count);
+    int *link = &fcb->extent_node; // 指向第 k 个节点的链接
+    for (int k = 0; k < have && k < need; ++k) {
+        link = &extent_nodes[*link - 1].next;
+    }
+    if (need > have) {
+        pthread_mutex_lock(&free_node_lock);
+        if (free_node_count < need - have) {
+            pthread_mutex_unlock(&free_node_lock);
+            return -1;
+        }
+        for (int k = have; k < need; ++k) {
+            *link = free_nodes[--free_node_count] + 1;
+            link = &extent_nodes[*link - 1].next;
+            *link = 0;
+        }
+        pthread_mutex_unlock(&free_node_lock);
+    } else if (need < have) {
+        int node = *link;
+        *link = 0;
+        pthread_mutex_lock(&free_node_lock);
+        while (node) {
+            free_nodes[free_node_count++] = node - 1;
+            node = extent_nodes[node - 1].next;
+        }
+        pthread_mutex_unlock(&free_node_lock);
+    }
+    fcb->extent_count = count;
+    return 0;
+}
+
+// 登记索引节点及其溢出节点链的修改
+static void journal_inode(FileControlBlock *fcb) {
+    journal_dirty(fcb, sizeof(FileControlBlock));
+    for (int node = fcb->extent_node; node; node = extent_nodes[node - 1].next) {
+        journal_dirty(&extent_nodes[node - 1], sizeof(ExtentNode));
+    }
+}
+
+void free_inode(FileControlBlock *fcb) {
+    fcb->filename[0] = '\0';
+    journal_dirty(fcb, sizeof(FileControlBlock));
+    pthread_mutex_lock(&free_inode_lock);
+    free_inodes[free_inode_count++] = fcb - inode_table;
+    pthread_mutex_unlock(&free_inode_lock);
+}
+
+static void lock_inode(FileControlBlock *fcb, int write) {
+    if (write) {
+        pthread_rwlock_wrlock(&inode_locks[fcb - inode_table]);
+    } else {
+        pthread_rwlock_rdlock(&inode_locks[fcb - inode_table]);
+    }
+}
+
+static void unlock_inode(FileControlBlock *fcb) {
+    pthread_rwlock_unlock(&inode_locks[fcb - inode_table]);
+}
+
+// 重建去重所需的内存结构: 引用计数由各文件的区段表统计得出, 被引用的块全部编入指纹索引
+static void dedup_init(int block_count) {
+    int size = 1;
+    while (size < 2 * block_count) {
+        size *= 2;
+    }
+    free(dedup.refs);
+    free(dedup.fingerprints);
+    free(dedup.index);
+    dedup.refs = (int *)calloc(block_count, sizeof(int));
+    dedup.fingerprints = (uint64_t *)calloc(block_count, sizeof(uint64_t));
+    dedup.index = (int *)malloc(size * sizeof(int));
+    memset(dedup.index, -1, size * sizeof(int));
+    dedup.index_mask = size - 1;
+    dedup.lookups = dedup.hits = 0;
+    pthread_mutex_init(&dedup.lock, NULL);
+    for (int i = 0; i < super_block->inode_count; ++i) {
+        for (int e = 0; inode_table[i].filename[0] && e < inode_table[i].extent_count; ++e) {
+            Extent *extent = file_extent(&inode_table[i], e);
+            for (int b = 0; b < extent->count; ++b) {
+                dedup.refs[extent->start + b]++;
+            }
+        }
+    }
+    char data[BLOCK_SIZE];
+    for (int b = 0; b < block_count; ++b) {
+        if (dedup.refs[b]) {
+            store_read(b, data, 1);
+            dedup_add(b, fingerprint(data));
+        }
+    }
+}
+
+static int64_t align_page(int64_t offset) {
+    return (offset + IMAGE_ALIGN - 1) / IMAGE_ALIGN * IMAGE_ALIGN;
+}
+
+// 校验已有映像的超级块: 各区须按布局顺序排列、互不重叠、按页对齐且都在文件之内
+static int check_super_block(const SuperBlock *sb, int64_t file_size) {
+    if (sb->magic != IMAGE_MAGIC || sb->version != IMAGE_VERSION || sb->block_size != BLOCK_SIZE)
+        return -1;
+    if (sb->block_count <= 0 || sb->block_count > MAX_BLOCK_COUNT || sb->inode_count <= 0 || sb->inode_count > MAX_INODE_COUNT)
+        return -1;
+    if (sb->extent_node_count < 0 || sb->extent_node_count > MAX_BLOCK_COUNT)
+        return -1;
+    int64_t offsets[] = {sb->journal_offset, sb->journal_size, sb->bitmap_offset, sb->inode_offset, sb->extent_offset, sb->data_offset, sb->image_size};
+    for (int i = 0; i < (int)(sizeof(offsets) / sizeof(offsets[0])); ++i) {
+        if (offsets[i] < 0 || offsets[i] > file_size || offsets[i] % IMAGE_ALIGN != 0)
+            return -1; // 以下相加不会溢出
+    }
+    int64_t bitmap_bytes = (sb->block_count + WORD_BITS - 1) / WORD_BITS * sizeof(uint64_t);
+    if (sb->journal_offset < (int64_t)sizeof(SuperBlock) || sb->journal_size <= BLOCK_SIZE ||
+        sb->bitmap_offset < sb->journal_offset + sb->journal_size || sb->inode_offset < sb->bitmap_offset + bitmap_bytes ||
+        sb->extent_offset < sb->inode_offset + sb->inode_count * (int64_t)sizeof(FileControlBlock) ||
+        sb->data_offset < sb->extent_offset + sb->extent_node_count * (int64_t)sizeof(ExtentNode) ||
+        sb->image_size != sb->data_offset + (int64_t)sb->block_count * BLOCK_SIZE)
+        return -1;
+    return 0;
+}
+
+// 挂载磁盘映像: 文件不存在或为空时按给定规格格式化, path 为 NULL 时使用匿名内存映像
+// 持久化映像的元数据区以私有方式映射, 修改只经日志和检查点到达映像文件
+int mount_disk(DiskSpaceManager *manager, Directory *root, const char *path, int block_count, int inode_count, int group_size) {
+    if (block_count <= 0 || block_count > MAX_BLOCK_COUNT || inode_count <= 0 || inode_count > MAX_INODE_COUNT) {
+        fprintf(stderr, "块数须在 1 到 %d 之间, 索引节点数须在 1 到 %d 之间\n", MAX_BLOCK_COUNT, MAX_INODE_COUNT);
+        return -1;
+    }
+    SuperBlock sb = {.magic = IMAGE_MAGIC, .version = IMAGE_VERSION, .block_size = BLOCK_SIZE, .block_count = block_count, .inode_count = inode_count};
+    int64_t bitmap_bytes = (block_count + WORD_BITS - 1) / WORD_BITS * sizeof(uint64_t);
+    int64_t inode_bytes = (int64_t)inode_count * sizeof(FileControlBlock);
+    // 每个区段至少一块, 按全部块都是单块区段预留溢出节点, 空间再零碎也不会因节点用完而失败
+    sb.extent_node_count = block_count / NODE_EXTENTS + 1;
+    int64_t node_bytes = (int64_t)sb.extent_node_count * sizeof(ExtentNode);
+    sb.journal_offset = IMAGE_ALIGN;
+    // 日志区至少能放下一个覆盖全部元数据的组, 任何提交组在检查点之后都放得下
+    int64_t metadata_bytes = align_page(bitmap_bytes) + align_page(inode_bytes) + node_bytes;
+    int64_t journal_bytes = BLOCK_SIZE + sizeof(JournalGroup) + sizeof(JournalRecord) + metadata_bytes;
+    journal_bytes = journal_bytes > 8 * bitmap_bytes ? journal_bytes : 8 * bitmap_bytes;
+    sb.journal_size = align_page(JOURNAL_SIZE > journal_bytes ? JOURNAL_SIZE : journal_bytes);
+    sb.bitmap_offset = sb.journal_offset + sb.journal_size;
+    sb.inode_offset = align_page(sb.bitmap_offset + bitmap_bytes);
+    sb.extent_offset = align_page(sb.inode_offset + inode_bytes);
+    sb.data_offset = align_page(sb.extent_offset + node_bytes);
+    sb.image_size = sb.data_offset + (int64_t)block_count * BLOCK_SIZE;
+    int fresh = 1;
+    if (path) {
+        struct stat st;
+        image_fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (image_fd < 0 || fstat(image_fd, &st) != 0) {
+            perror("打开磁盘映像失败");
+            goto fail;
+        }
+        if (st.st_size > 0) {
+            if (pread(image_fd, &sb, sizeof(sb), 0) != sizeof(sb) || check_super_block(&sb, st.st_size) != 0) {
+                fprintf(stderr, "磁盘映像格式不正确: %s\n", path);
+                goto fail;
+            }
+            fresh = 0;
+        } else if (ftruncate(image_fd, sb.image_size) != 0 || pwrite(image_fd, &sb, sizeof(sb), 0) != sizeof(sb)) {
+            perror("创建磁盘映像失败"); // 新建的映像全为零, 写入超级块即完成格式化
+            goto fail;
+        }
+        disk_image = (char *)mmap(NULL, sb.data_offset, PROT_READ | PROT_WRITE, MAP_PRIVATE, image_fd, 0);
+        disk_memory = (char *)mmap(NULL, sb.image_size - sb.data_offset, PROT_READ | PROT_WRITE, MAP_SHARED, image_fd, sb.data_offset);
+        disk_view = (const char *)mmap(NULL, sb.image_size - sb.data_offset, PROT_READ, MAP_SHARED, image_fd, sb.data_offset);
+    } else {
+        disk_image = (char *)mmap(NULL, sb.image_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        disk_memory = disk_image == MAP_FAILED ? disk_image : disk_image + sb.data_offset;
+        disk_view = disk_memory; // 匿名映像无法再映射一份, 视图只在类型上只读
+    }
+    if (disk_image == MAP_FAILED || disk_memory == MAP_FAILED || disk_view == MAP_FAILED) {
+        perror("映射磁盘映像失败");
+        if (disk_image != MAP_FAILED) {
+            munmap(disk_image, path ? sb.data_offset : sb.image_size);
+        }
+        if (path && disk_memory != MAP_FAILED) {
+            munmap(disk_memory, sb.image_size - sb.data_offset);
+        }
+        if (path && disk_view != MAP_FAILED) {
+            munmap((void *)disk_view, sb.image_size - sb.data_offset);
+        }
+        goto fail;
+    }
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    // 写者优先, 日志提交不会被源源不断的元数据操作饿死
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&meta_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    super_block = (SuperBlock *)disk_image;
+    if (fresh) {
+        *super_block = sb;
+    }
+    inode_table = (FileControlBlock *)(disk_image + sb.inode_offset);
+    extent_nodes = (ExtentNode *)(disk_image + sb.extent_offset);
+    journal_init(group_size); // 重放日志须在重建位示图和目录之前
+    init_disk_space_manager(manager, (uint64_t *)(disk_image + sb.bitmap_offset), sb.block_count);
+    init_directory(root, "根目录");
+    root_dir = root;
+    directory_table = (Directory **)calloc(sb.inode_count, sizeof(Directory *));
+    inode_locks = (pthread_rwlock_t *)malloc(sb.inode_count * sizeof(pthread_rwlock_t));
+    for (int i = 0; i < sb.inode_count; ++i) {
+        pthread_rwlock_init(&inode_locks[i], NULL);
+    }
+    free_inodes = (int *)malloc(sb.inode_count * sizeof(int));
+    free_inode_count = 0;
+    // 先为所有目录节点建立目录对象, 再把每个节点挂到所在目录下
+    for (int i = 0; i < sb.inode_count; ++i) {
+        if (inode_table[i].filename[0] && inode_table[i].is_dir) {
+            directory_table[i] = (Directory *)malloc(sizeof(Directory));
+            init_directory(directory_table[i], inode_table[i].filename);
+            directory_table[i]->ino = i;
+        }
+    }
+    for (int i = sb.inode_count - 1; i >= 0; --i) {
+        if (inode_table[i].filename[0]) {
+            int parent = inode_table[i].parent;
+            Directory *dir = parent >= 0 && parent < sb.inode_count && directory_table[parent] ? directory_table[parent] : root;
+            dir_insert(dir, &inode_table[i]);
+            if (directory_table[i]) {
+                directory_table[i]->parent = dir;
+            }
+        } else {
+            free_inodes[free_inode_count++] = i;
+        }
+    }
+    // 各文件的节点链上的溢出节点在用, 其余节点入空闲栈
+    char *node_used = (char *)calloc(sb.extent_node_count, 1);
+    for (int i = 0; i < sb.inode_count; ++i) {
+        int node = inode_table[i].filename[0] ? inode_table[i].extent_node : 0;
+        for (; node > 0 && node <= sb.extent_node_count && !node_used[node - 1]; node = extent_nodes[node - 1].next) {
+            node_used[node - 1] = 1;
+        }
+    }
+    free_nodes = (int *)malloc(sb.extent_node_count * sizeof(int));
+    free_node_count = 0;
+    for (int i = sb.extent_node_count - 1; i >= 0; --i) {
+        if (!node_used[i]) {
+            free_nodes[free_node_count++] = i;
+        }
+    }
+    free(node_used);
+    memset(&dcache, 0, sizeof(dcache));
+    for (int i = 0; i < DCACHE_LOCKS; ++i) {
+        pthread_mutex_init(&dcache.locks[i], NULL);
+    }
+    cache_init();
+    last_access = (time_t *)malloc(sb.inode_count * sizeof(time_t));
+    open_counts = (int *)calloc(sb.inode_count, sizeof(int));
+    for (int i = 0; i < sb.inode_count; ++i) {
+        last_access[i] = time(NULL);
+    }
+    // 启用过去重的映像中可能有共享块, 此后每次挂载都须维护引用计数, 否则释放共享块会破坏其他文件
+    if (dedup_enabled || (super_block->features & FEATURE_DEDUP)) {
+        if (!(super_block->features & FEATURE_DEDUP)) {
+            super_block->features |= FEATURE_DEDUP;
+            if (image_fd >= 0 && (pwrite(image_fd, super_block, sizeof(SuperBlock), 0) != sizeof(SuperBlock) || fdatasync(image_fd) != 0)) {
+                perror("写入超级块失败");
+                return -1;
+            }
+        }
+        dedup_init(sb.block_count);
+    }
+    return 0;
+fail:
+    if (image_fd >= 0) {
+        close(image_fd);
+        image_fd = -1;
+    }
+    return -1;
+}
+
+void unmount_disk() {
+    while (retired_dirs) {
+        Directory *next = retired_dirs->next_retired;
+        destroy_directory(retired_dirs);
+        retired_dirs = next;
+    }
+    cache_flush();
+    if (image_fd < 0) {
+        munmap(disk_image, super_block->image_size);
+        return;
+    }
+    journal_flush();
+    journal_checkpoint();
+    msync(disk_memory, super_block->image_size - super_block->data_offset, MS_SYNC);
+    munmap((void *)disk_view, super_block->image_size - super_block->data_offset);
+    munmap(disk_memory, super_block->image_size - super_block->data_offset);
+    munmap(disk_image, super_block->data_offset);
+    close(image_fd);
+}
+
+// 释放文件 keep 块之后的所有块
+void truncate_blocks(DiskSpaceManager *manager, FileControlBlock *fcb, int keep) {
+    while (fcb->block_count > keep) {
+        Extent *last = file_extent(fcb, fcb->extent_count - 1);
+        int n = fcb->block_count - keep < last->count ? fcb->block_count - keep : last->count;
+        if (!dedup.refs) { // 共享的块可能仍被其他文件引用, 其缓冲留到块重新分配时再丢弃
+            cache_invalidate(last->start + last->count - n, n);
+        }
+        free_blocks(manager, last->start + last->count - n, n);
+        last->count -= n;
+        fcb->block_count -= n;
+        if (last->count == 0) {
+            resize_extents(fcb, fcb->extent_count - 1);
+        }
+    }
+    journal_inode(fcb);
+}
+
+// 为文件追加块直到共有 blocks 块, 新块清零, 失败时回退到原大小
+int extend_file(DiskSpaceManager *manager, FileControlBlock *fcb, int blocks) {
+    int old = fcb->block_count;
+    while (fcb->block_count < blocks) {
+        Extent *last = fcb->extent_count ? file_extent(fcb, fcb->extent_count - 1) : NULL;
+        int goal = last ? last->start + last->count : -1;
+        int got;
+        int start = allocate_extent(manager, goal, blocks - fcb->block_count, &got);
+        if (start == -1 || (start != goal && resize_extents(fcb, fcb->extent_count + 1) != 0)) {
+            if (start != -1) {
+                free_blocks(manager, start, got);
+            }
+            truncate_blocks(manager, fcb, old);
+            return -1;
+        }
+        cache_invalidate(start, got);
+        store_zero(start, got);
+        if (start == goal) {
+            last->count += got;
+        } else {
+            file_extent(fcb, fcb->extent_count - 1)->start = start;
+            file_extent(fcb, fcb->extent_count - 1)->count = got;
+        }
+        fcb->block_count += got;
+    }
+    journal_inode(fcb);
+    return 0;
+}
+
+// 把文件的 [offset, offset + size) 所在的块按区段成批预读进缓存
+static void prefetch_extents(FileControlBlock *fcb, int offset, int size) {
+    int file_pos = 0;
+    for (int i = 0; i < fcb->extent_count && size > 0; ++i) {
+        Extent *extent = file_extent(fcb, i);
+        int extent_bytes = extent->count * BLOCK_SIZE;
+        if (offset < file_pos + extent_bytes) {
+            int skip = offset - file_pos;
+            int n = extent_bytes - skip < size ? extent_bytes - skip : size;
+            cache_readahead(extent->start + skip / BLOCK_SIZE, (skip + n - 1) / BLOCK_SIZE - skip / BLOCK_SIZE + 1);
+            offset += n;
+            size -= n;
+        }
+        file_pos += extent_bytes;
+    }
+}
+
+// 在文件的 [offset, offset + size) 与各区段的交集上经缓冲区缓存逐块拷贝, to_disk 决定拷贝方向
+static void copy_extents(FileControlBlock *fcb, int offset, char *buffer, int size, int to_disk) {
+    int file_pos = 0;
+    for (int i = 0; i < fcb->extent_count && size > 0; ++i) {
+        Extent *extent = file_extent(fcb, i);
+        int extent_bytes = extent->count * BLOCK_SIZE;
+        if (offset < file_pos + extent_bytes) {
+            int skip = offset - file_pos;
+            int n = extent_bytes - skip < size ? extent_bytes - skip : size;
+            while (n > 0) {
+                int block = extent->start + skip / BLOCK_SIZE;
+                int from = skip % BLOCK_SIZE;
+                int len = BLOCK_SIZE - from < n ? BLOCK_SIZE - from : n;
+                BufferCache *shard = cache_shard(block);
+                pthread_mutex_lock(&shard->lock);
+                if (to_disk) {
+                    Buffer *b = len == BLOCK_SIZE ? bget(block) : bread(block);
+                    memcpy(b->data + from, buffer, len);
+                    b->dirty = 1;
+                } else {
+                    memcpy(buffer, bread(block)->data + from, len);
+                }
+                pthread_mutex_unlock(&shard->lock);
+                buffer += len;
+                offset += len;
+                size -= len;
+                skip += len;
+                n -= len;
+            }
+        }
+        file_pos += extent_bytes;
+    }
+}
+
+// 简单的 LZ77 压缩, 格式仿 LZ4: 每个序列为 标记字节(高 4 位字面量长度, 低 4 位匹配长度减 4)
+// + 长度扩展字节 + 字面量 + 2 字节匹配距离 + 匹配长度扩展字节, 最后一个序列只有字面量
+static int lz_length(char *dst, int op, int n) {
+    for (; n >= 255; n -= 255) {
+        dst[op++] = (char)255;
+    }
+    dst[op++] = (char)n;
+    return op;
+}
+
+// 输出一个序列, 超出 cap 时返回 -1
+static int lz_emit(char *dst, int cap, int op, const char *literal, int literal_len, int distance, int match_len) {
+    int m = match_len ? match_len - 4 : 0;
+    if (op + 1 + literal_len / 255 + 1 + literal_len + 2 + m / 255 + 1 > cap)
+        return -1;
+    dst[op++] = (char)((literal_len < 15 ? literal_len : 15) << 4 | (m < 15 ? m : 15));
+    if (literal_len >= 15) {
+        op = lz_length(dst, op, literal_len - 15);
+    }
+    memcpy(dst + op, literal, literal_len);
+    op += literal_len;
+    if (match_len) {
+        dst[op++] = (char)(distance & 255);
+        dst[op++] = (char)(distance >> 8);
+        if (m >= 15) {
+            op = lz_length(dst, op, m - 15);
+        }
+    }
+    return op;
+}
+
+// 压缩 src 的 n 字节到 dst, 结果超过 cap 字节时返回 -1
+static int lz_compress(const char *src, int n, char *dst, int cap) {
+    int table[4096] = {0}; // 4 字节序列的散列 -> 最近出现位置加一
+    int ip = 0, anchor = 0, op = 0;
+    while (ip + 4 <= n) {
+        uint32_t seq;
+        memcpy(&seq, src + ip, 4);
+        int h = (seq * 2654435761u) >> 20;
+        int ref = table[h] - 1;
+        table[h] = ip + 1;
+        if (ref < 0 || ip - ref > 65535 || memcmp(src + ref, src + ip, 4) != 0) {
+            ip++;
+            continue;
+        }
+        int len = 4;
+        while (ip + len < n && src[ref + len] == src[ip + len]) {
+            len++;
+        }
+        if ((op = lz_emit(dst, cap, op, src + anchor, ip - anchor, ip - ref, len)) < 0)
+            return -1;
+        ip += len;
+        anchor = ip;
+    }
+    return lz_emit(dst, cap, op, src + anchor, n - anchor, 0, 0);
+}
+
+// 解压到 dst, 返回解压后的字节数, 数据损坏时返回 -1
+static int lz_decompress(const char *src, int n, char *dst, int cap) {
+    const unsigned char *ip = (const unsigned char *)src, *end = ip + n;
+    int op = 0;
+    while (ip < end) {
+        int token = *ip++, b;
+        int literal_len = token >> 4, match_len = (token & 15) + 4;
+        if (literal_len == 15) {
+            do {
+                b = ip < end ? *ip++ : 0;
+                literal_len += b;
+            } while (b == 255);
+        }
+        if (literal_len > end - ip || op + literal_len > cap)
+            return -1;
+        memcpy(dst + op, ip, literal_len);
+        ip += literal_len;
+        op += literal_len;
+        if (ip == end)
+            break;
+        if (end - ip < 2)
+            return -1;
+        int distance = ip[0] | ip[1] << 8;
+        ip += 2;
+        if ((token & 15) == 15) {
+            do {
+                b = ip < end ? *ip++ : 0;
+                match_len += b;
+            } while (b == 255);
+        }
+        if (distance == 0 || distance > op || op + match_len > cap)
+            return -1;
+        for (int i = 0; i < match_len; ++i, ++op) {
+            dst[op] = dst[op - distance]; // 距离可能小于长度, 须逐字节复制
+        }
+    }
+    return op;
+}
+
+// 读出压缩文件的全部内容并解压, 返回 malloc 的缓冲区
+static char *load_compressed(FileControlBlock *fcb) {
+    char *packed = (char *)malloc(fcb->compressed_size);
+    char *raw = (char *)malloc(fcb->size > 0 ? fcb->size : 1);
+    copy_extents(fcb, 0, packed, fcb->compressed_size, 0);
+    if (lz_decompress(packed, fcb->compressed_size, raw, fcb->size) != fcb->size) {
+        fprintf(stderr, "文件 %s 的压缩数据已损坏\n", fcb->filename);
+        memset(raw, 0, fcb->size);
+    }
+    free(packed);
+    return raw;
+}
+
+// 从 offset 处读取最多 size 字节, 返回实际读取的字节数
+int read_file_at(FileControlBlock *fcb, int offset, char *buffer, int size) {
+    if (offset < 0 || offset >= fcb->size)
+        return 0;
+    if (size > fcb->size - offset)
+        size = fcb->size - offset;
+    if (last_access) {
+        __atomic_store_n(&last_access[fcb - inode_table], time(NULL), __ATOMIC_RELAXED);
+    }
+    if (fcb->compressed_size) { // 压缩的文件整体解压后再取所需部分
+        char *raw = load_compressed(fcb);
+        memcpy(buffer, raw + offset, size);
+        free(raw);
+        return size;
+    }
+    // 跨块读取或接着上次读取的位置继续读时, 视为顺序读并向后预读
+    if (size > BLOCK_SIZE || (fcb == last_read_fcb && offset == last_read_end)) {
+        int ahead = size + READ_AHEAD * BLOCK_SIZE;
+        prefetch_extents(fcb, offset, ahead < fcb->block_count * BLOCK_SIZE - offset ? ahead : fcb->block_count * BLOCK_SIZE - offset);
+    }
+    copy_extents(fcb, offset, buffer, size, 0);
+    last_read_fcb = fcb;
+    last_read_end = offset + size;
+    return size;
+}
+
+// 把压缩文件还原为未压缩的存储, 写入前调用
+static int inflate_file(DiskSpaceManager *manager, FileControlBlock *fcb) {
+    char *raw = load_compressed(fcb);
+    fcb->compressed_size = 0;
+    truncate_blocks(manager, fcb, 0);
+    int ok = extend_file(manager, fcb, (fcb->size + BLOCK_SIZE - 1) / BLOCK_SIZE) == 0;
+    if (ok) {
+        copy_extents(fcb, 0, raw, fcb->size, 1);
+    }
+    free(raw);
+    return ok ? 0 : -1;
+}
+
+// 写时复制: 区段中有块被其他文件共享时, 把整个区段复制到新分配的块上再写
+// 空闲空间零碎时新块可以分成几段, 区段表中原区段换成这几段, 返回替换后的区段数, 失败返回 -1
+// 独占的块即将被改写, 先从去重索引中撤销
+static int unshare_extent(DiskSpaceManager *manager, FileControlBlock *fcb, int index) {
+    Extent extent = *file_extent(fcb, index);
+    int shared = 0;
+    pthread_mutex_lock(&dedup.lock);
+    for (int i = extent.start; i < extent.start + extent.count; ++i) {
+        if (dedup.refs[i] > 1) {
+            shared = 1;
+        } else {
+            dedup_remove(i);
+        }
+    }
+    pthread_mutex_unlock(&dedup.lock);
+    if (!shared)
+        return 1;
+    // 一个区段最多换成 MAX_EXTENTS 段, 更零碎时放弃
+    Extent runs[MAX_EXTENTS];
+    int run_count = 0, copied = 0;
+    while (copied < extent.count) {
+        Extent *last = run_count ? &runs[run_count - 1] : NULL;
+        int goal = last ? last->start + last->count : -1;
+        int got;
+        int start = allocate_extent(manager, goal, extent.count - copied, &got);
+        if (start == -1 || (start != goal && run_count == MAX_EXTENTS)) {
+            if (start != -1) {
+                free_blocks(manager, start, got);
+            }
+            goto fail;
+        }
+        cache_invalidate(start, got);
+        if (start == goal) {
+            last->count += got;
+        } else {
+            runs[run_count].start = start;
+            runs[run_count].count = got;
+            run_count++;
+        }
+        copied += got;
+    }
+    int old_count = fcb->extent_count;
+    if (resize_extents(fcb, old_count + run_count - 1) != 0)
+        goto fail;
+    int from = extent.start;
+    for (int r = 0; r < run_count; ++r) {
+        for (int i = 0; i < runs[r].count; ++i, ++from) {
+            char data[BLOCK_SIZE];
+            BufferCache *shard = cache_shard(from);
+            pthread_mutex_lock(&shard->lock);
+            memcpy(data, bread(from)->data, BLOCK_SIZE);
+            pthread_mutex_unlock(&shard->lock);
+            shard = cache_shard(runs[r].start + i);
+            pthread_mutex_lock(&shard->lock);
+            Buffer *b = bget(runs[r].start + i);
+            memcpy(b->data, data, BLOCK_SIZE);
+            b->dirty = 1;
+            pthread_mutex_unlock(&shard->lock);
+        }
+    }
+    free_blocks(manager, extent.start, extent.count);
+    for (int i = old_count - 1; i > index; --i) { // 其后的区段后移, 为替换进来的各段腾出位置
+        *file_extent(fcb, i + run_count - 1) = *file_extent(fcb, i);
+    }
+    for (int r = 0; r < run_count; ++r) {
+        *file_extent(fcb, index + r) = runs[r];
+    }
+    return run_count;
+fail:
+    for (int i = 0; i < run_count; ++i) {
+        free_blocks(manager, runs[i].start, runs[i].count);
+    }
+    return -1;
+}
+
+// 在 offset 处写入 size 字节, 必要时扩展文件, 返回写入的字节数
+int write_file_at(DiskSpaceManager *manager, FileControlBlock *fcb, int offset, const char *data, int size) {
+    if (offset < 0 || size < 0)
+        return -1;
+    if (last_access) {
+        __atomic_store_n(&last_access[fcb - inode_table], time(NULL), __ATOMIC_RELAXED);
+    }
+    if (fcb->compressed_size && inflate_file(manager, fcb) != 0)
+        return -1;
+    int end = offset + size;
+    if (extend_file(manager, fcb, (end + BLOCK_SIZE - 1) / BLOCK_SIZE) != 0)
+        return -1;
+    if (dedup.refs) {
+        int file_pos = 0;
+        for (int i = 0; i < fcb->extent_count; ++i) {
+            int extent_bytes = file_extent(fcb, i)->count * BLOCK_SIZE;
+            if (offset < file_pos + extent_bytes && end > file_pos) {
+                int pieces = unshare_extent(manager, fcb, i);
+                if (pieces == -1)
+                    return -1;
+                i += pieces - 1; // 跳过替换进来的各段
+            }
+            file_pos += extent_bytes;
+        }
+    }
+    copy_extents(fcb, offset, (char *)data, size, 1);
+    if (end > fcb->size)
+        fcb->size = end;
+    journal_inode(fcb);
+    return size;
+}
 
-typedef struct {
-    char bitmap[BLOCK_COUNT / 8]; // 位示图
-} DiskSpaceManager;
+// 查找内容与 data 相同的已有块, 找到时增加其引用计数并返回块号, 否则返回 -1
+static int dedup_share(uint64_t fp, const char *data) {
+    int block = -1;
+    pthread_mutex_lock(&dedup.lock);
+    dedup.lookups++;
+    int i = dedup_find(fp);
+    if (i != -1) {
+        BufferCache *shard = cache_shard(dedup.index[i]);
+        pthread_mutex_lock(&shard->lock);
+        if (memcmp(bread(dedup.index[i])->data, data, BLOCK_SIZE) == 0) { // 指纹相同仍须比对内容
+            block = dedup.index[i];
+            dedup.refs[block]++;
+            dedup.hits++;
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+    pthread_mutex_unlock(&dedup.lock);
+    return block;
+}
 
-typedef struct FileControlBlock {
-    char filename[36]; // 包含扩展名的文件名
-    int start_block;
-    int size;
-    int is_open;
-    time_t creation_time;
-    FileAttribute attribute;
-    struct FileControlBlock *next;
-} FileControlBlock;
+// 按块查重写入空文件: 与已有块内容相同的块直接引用, 其余块新分配并登记指纹
+// 溢出节点或空间不足时撤销并返回 -1, 调用者退回普通写入
+static int dedup_write(DiskSpaceManager *manager, FileControlBlock *fcb, const char *data, int size) {
+    char block[BLOCK_SIZE];
+    for (int i = 0; i * BLOCK_SIZE < size; ++i) {
+        int len = size - i * BLOCK_SIZE < BLOCK_SIZE ? size - i * BLOCK_SIZE : BLOCK_SIZE;
+        memcpy(block, data + i * BLOCK_SIZE, len);
+        memset(block + len, 0, BLOCK_SIZE - len); // 末块按补零后的整块内容查重
+        uint64_t fp = fingerprint(block);
+        Extent *last = fcb->extent_count ? file_extent(fcb, fcb->extent_count - 1) : NULL;
+        int target = dedup_share(fp, block);
+        if (target == -1) {
+            int got;
+            target = allocate_extent(manager, last ? last->start + last->count : -1, 1, &got);
+            if (target == -1)
+                goto fail;
+            cache_invalidate(target, 1);
+            BufferCache *shard = cache_shard(target);
+            pthread_mutex_lock(&shard->lock);
+            Buffer *b = bget(target);
+            memcpy(b->data, block, BLOCK_SIZE);
+            b->dirty = 1;
+            pthread_mutex_unlock(&shard->lock);
+            pthread_mutex_lock(&dedup.lock);
+            dedup_add(target, fp);
+            pthread_mutex_unlock(&dedup.lock);
+        }
+        if (last && last->start + last->count == target) {
+            last->count++;
+        } else if (resize_extents(fcb, fcb->extent_count + 1) == 0) {
+            file_extent(fcb, fcb->extent_count - 1)->start = target;
+            file_extent(fcb, fcb->extent_count - 1)->count = 1;
+        } else {
+            free_block(manager, target);
+            goto fail;
+        }
+        fcb->block_count++;
+    }
+    fcb->size = size;
+    journal_inode(fcb);
+    return 0;
+fail:
+    truncate_blocks(manager, fcb, 0);
+    return -1;
+}
 
-typedef struct Directory {
-    char dirname[32];
-    FileControlBlock *fcb[MAX_FILES];
-    int file_count;
-    struct Directory *subdirs[MAX_DIRS];
-    int dir_count;
-} Directory;
+// 压缩一个文件, 压缩后至少能少占一块时才替换原数据, 返回省下的块数; 调用者持有索引节点写锁
+static int compress_file(DiskSpaceManager *manager, FileControlBlock *fcb) {
+    if (fcb->is_dir || fcb->compressed_size || open_counts[fcb - inode_table] || fcb->size <= BLOCK_SIZE)
+        return 0;
+    int size = fcb->size, blocks = fcb->block_count;
+    time_t accessed = last_access[fcb - inode_table];
+    char *raw = (char *)malloc(size), *packed = (char *)malloc(size);
+    read_file_at(fcb, 0, raw, size);
+    int n = lz_compress(raw, size, packed, (size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE - BLOCK_SIZE);
+    if (n > 0) {
+        truncate_blocks(manager, fcb, 0);
+        fcb->size = 0;
+        if ((dedup.refs && dedup_write(manager, fcb, packed, n) == 0) || write_file_at(manager, fcb, 0, packed, n) == n) {
+            fcb->compressed_size = n; // 内容相同的文件压缩后仍可共享块
+        } else { // 压缩数据写不进去时恢复原样
+            truncate_blocks(manager, fcb, 0);
+            fcb->size = 0;
+            write_file_at(manager, fcb, 0, raw, size);
+        }
+        fcb->size = size;
+        journal_dirty(fcb, sizeof(FileControlBlock));
+    }
+    last_access[fcb - inode_table] = accessed; // 压缩不算作访问
+    free(raw);
+    free(packed);
+    return blocks - fcb->block_count;
+}
 
-void init_disk_space_manager(DiskSpaceManager *manager) {
-    memset(manager->bitmap, 0, sizeof(manager->bitmap));
+// 在目录中查找名称, 调用者须持有目录的锁
+FileControlBlock *find_file(Directory *dir, const char *filename) {
+    return dir->fcb[dir_slot(dir, filename)];
 }
 
-int allocate_block(DiskSpaceManager *manager) {
-    for (int i = 0; i < BLOCK_COUNT; ++i) {
-        if (!(manager->bitmap[i / 8] & (1 << (i % 8)))) {
-            manager->bitmap[i / 8] |= (1 << (i % 8));
-            return i;
+// 持读锁查找, 目录已被删除时视为不存在
+static FileControlBlock *dir_lookup(Directory *dir, const char *filename) {
+    pthread_rwlock_rdlock(&dir->lock);
+    FileControlBlock *fcb = dir->removed ? NULL : find_file(dir, filename);
+    pthread_rwlock_unlock(&dir->lock);
+    return fcb;
+}
+
+// 从 start 出发沿目录路径逐级查找, 以 / 开头时从根目录出发, 空路径表示 start 本身
+// 每一级只在查找期间持有该级目录的读锁, 目录对象删除后不会立即释放, 因此指针始终有效
+static Directory *walk_directories(Directory *start, const char *path) {
+    Directory *dir = path[0] == '/' ? root_dir : start;
+    char name[36];
+    while (*path) {
+        path += strspn(path, "/");
+        int n = strcspn(path, "/");
+        if (n == 0)
+            break;
+        if (n >= (int)sizeof(name))
+            return NULL;
+        memcpy(name, path, n);
+        name[n] = '\0';
+        path += n;
+        if (strcmp(name, "..") == 0) {
+            Directory *parent = __atomic_load_n(&dir->parent, __ATOMIC_ACQUIRE);
+            dir = parent ? parent : dir;
+        } else if (strcmp(name, ".") != 0) {
+            pthread_rwlock_rdlock(&dir->lock);
+            FileControlBlock *fcb = dir->removed ? NULL : find_file(dir, name);
+            Directory *child = fcb && fcb->is_dir ? directory_table[fcb - inode_table] : NULL;
+            pthread_rwlock_unlock(&dir->lock);
+            if (!child)
+                return NULL;
+            dir = child;
         }
     }
-    return -1;
+    return dir;
 }
 
-void free_block(DiskSpaceManager *manager, int block_index) {
-    manager->bitmap[block_index / 8] &= ~(1 << (block_index % 8));
+// 使目录项缓存整体失效
+static void dcache_invalidate() {
+    __atomic_fetch_add(&dcache.generation, 1, __ATOMIC_RELEASE);
 }
 
-int create_file(Directory *dir, DiskSpaceManager *manager, const char *filename, const char *data, int size, FileAttribute attribute) {
-    FILE *file = fopen(filename, "wb");
+// 经目录项缓存查找目录路径, 返回的目录可能随后被删除, 调用者加锁后须检查 removed
+Directory *lookup_directory(Directory *start, const char *path) {
+    if (path[0] == '/')
+        start = root_dir;
+    int slot = (hash_name(path) ^ (unsigned int)(uintptr_t)start) % DCACHE_SIZE;
+    DentryCacheEntry *entry = &dcache.entries[slot];
+    pthread_mutex_t *lock = &dcache.locks[slot % DCACHE_LOCKS];
+    unsigned int generation = __atomic_load_n(&dcache.generation, __ATOMIC_ACQUIRE);
+    pthread_mutex_lock(lock);
+    if (entry->dir && entry->generation == generation && entry->start == start && strcmp(entry->path, path) == 0) {
+        Directory *dir = entry->dir;
+        pthread_mutex_unlock(lock);
+        __atomic_fetch_add(&dcache.hits, 1, __ATOMIC_RELAXED);
+        return dir;
+    }
+    pthread_mutex_unlock(lock);
+    __atomic_fetch_add(&dcache.misses, 1, __ATOMIC_RELAXED);
+    Directory *dir = walk_directories(start, path);
+    if (dir && strlen(path) < sizeof(entry->path)) {
+        // 以查找前的代数登记, 查找期间发生的失效会使该表项随即作废
+        pthread_mutex_lock(lock);
+        entry->start = start;
+        strcpy(entry->path, path);
+        entry->dir = dir;
+        entry->generation = generation;
+        pthread_mutex_unlock(lock);
+    }
+    return dir;
+}
+
+// 把路径拆成所在目录和最后一级名称, 返回所在目录, 名称写入 name
+static Directory *resolve_parent(Directory *start, const char *path, char *name) {
+    char dir_path[MAX_PATH];
+    const char *slash = strrchr(path, '/');
+    const char *leaf = slash ? slash + 1 : path;
+    if (strlen(path) >= MAX_PATH || strlen(leaf) == 0 || strlen(leaf) >= 36 ||
+        strcmp(leaf, ".") == 0 || strcmp(leaf, "..") == 0)
+        return NULL;
+    if (!slash) {
+        dir_path[0] = '\0';
+    } else if (slash == path) {
+        strcpy(dir_path, "/");
+    } else {
+        memcpy(dir_path, path, slash - path);
+        dir_path[slash - path] = '\0';
+    }
+    strcpy(name, leaf);
+    return lookup_directory(start, dir_path);
+}
+
+// 宿主文件系统上的对应路径: 根目录对应当前工作目录
+static const char *host_path(const char *path) {
+    return path + strspn(path, "/");
+}
+
+// 查找路径对应的文件或目录节点, 返回时已持有该节点的锁 (write 为 1 时为写锁), 用毕以 unlock_inode 释放
+FileControlBlock *lock_path(Directory *start, const char *path, int write) {
+    char name[36];
+    Directory *dir = resolve_parent(start, path, name);
+    if (!dir)
+        return NULL;
+    pthread_rwlock_rdlock(&dir->lock);
+    FileControlBlock *fcb = dir->removed ? NULL : find_file(dir, name);
+    if (fcb) {
+        lock_inode(fcb, write);
+    }
+    pthread_rwlock_unlock(&dir->lock);
+    return fcb;
+}
+
+// 把新建文件的内容写到宿主文件, 失败时删除写了一半的宿主文件
+static int mirror_file(const char *path, const char *data, int size) {
+    FILE *file = fopen(host_path(path), "wb");
     if (!file) {
         perror("创建文件失败");
         return -1;
     }
-    if (fwrite(data, 1, size, file) != size) {
+    int ok = fwrite(data, 1, size, file) == (size_t)size;
+    ok = fclose(file) == 0 && ok; // 缓冲中的数据在关闭时才写出
+    if (!ok) {
         perror("写入文件失败");
-        fclose(file);
-        return -1;
+        remove(host_path(path));
     }
-    fclose(file);
-    if (dir->file_count >= MAX_FILES)
-        return -1;
-    int block_index = allocate_block(manager);
-    if (block_index == -1)
+    return ok ? 0 : -1;
+}
+
+int create_file(Directory *cwd, DiskSpaceManager *manager, const char *path, const char *data, int size, FileAttribute attribute) {
+    char filename[36];
+    if (size < 0)
         return -1;
-    FileControlBlock *fcb = (FileControlBlock *)malloc(sizeof(FileControlBlock));
-    if (!fcb)
-        return -1; // 检查内存分配
+    pthread_rwlock_rdlock(&meta_lock);
+    Directory *dir = resolve_parent(cwd, path, filename);
+    if (!dir || dir_lookup(dir, filename)) {
+        pthread_rwlock_unlock(&meta_lock);
+        return -1; // 目录不存在或同名文件已存在
+    }
+    FileControlBlock *fcb = alloc_inode();
+    if (!fcb) {
+        pthread_rwlock_unlock(&meta_lock);
+        return -1; // 索引节点已用完
+    }
     strcpy(fcb->filename, filename);
-    fcb->start_block = block_index;
-    fcb->size = size;
-    fcb->is_open = 0;
     fcb->creation_time = time(NULL);
     fcb->attribute = attribute;
-    fcb->next = NULL;
-    memcpy(disk_memory + block_index * BLOCK_SIZE, data, size);
-    dir->fcb[dir->file_count++] = fcb;
-    return 0;
+    fcb->parent = dir->ino;
+    // 新节点挂入目录之前其他线程看不到它, 写入数据时无需持有目录锁
+    int ok = (dedup.refs && dedup_write(manager, fcb, data, size) == 0) || write_file_at(manager, fcb, 0, data, size) == size;
+    if (ok) {
+        pthread_rwlock_wrlock(&dir->lock);
+        ok = !dir->removed && !find_file(dir, filename); // 其间可能有其他线程创建了同名文件
+        // 确定能插入后才写宿主文件, 持目录锁写入, 同名文件的创建和删除不会与之交错
+        if (ok && host_mirror) {
+            ok = mirror_file(path, data, size) == 0;
+        }
+        if (ok) {
+            dir_insert(dir, fcb);
+        }
+        pthread_rwlock_unlock(&dir->lock);
+        if (!ok) {
+            truncate_blocks(manager, fcb, 0);
+        }
+    }
+    if (!ok) {
+        free_inode(fcb);
+    }
+    end_metadata_op();
+    return ok ? 0 : -1;
+}
+
+int read_file(Directory *cwd, const char *path, int offset, char *buffer, int size) {
+    FileControlBlock *fcb = lock_path(cwd, path, 0);
+    if (!fcb)
+        return -1;
+    int n = fcb->is_dir ? -1 : read_file_at(fcb, offset, buffer, size);
+    unlock_inode(fcb);
+    return n;
 }
 
-int read_file(Directory *dir, const char *filename, char *buffer, int size) {
-    for (int i = 0; i < dir->file_count; ++i) {
-        if (strcmp(dir->fcb[i]->filename, filename) == 0) {
-            int block_index = dir->fcb[i]->start_block;
-            memcpy(buffer, disk_memory + block_index * BLOCK_SIZE, size);
-            return dir->fcb[i]->size;
+int write_file(Directory *cwd, DiskSpaceManager *manager, const char *path, int offset, const char *data, int size) {
+    pthread_rwlock_rdlock(&meta_lock);
+    FileControlBlock *fcb = lock_path(cwd, path, 1);
+    int written = -1;
+    if (!fcb || fcb->is_dir || fcb->attribute == FILE_READONLY || offset < 0 || size < 0)
+        goto out;
+    if (host_mirror) {
+        FILE *file = fopen(host_path(path), "r+b");
+        if (!file) {
+            perror("写入文件失败");
+            goto out;
+        }
+        if (fseek(file, offset, SEEK_SET) != 0 || fwrite(data, 1, size, file) != (size_t)size) {
+            perror("写入文件失败");
+            fclose(file);
+            goto out;
+        }
+        if (fclose(file) != 0) {
+            perror("写入文件失败");
+            goto out;
         }
     }
-    return -1;
+    written = write_file_at(manager, fcb, offset, data, size);
+out:
+    if (fcb) {
+        unlock_inode(fcb);
+    }
+    end_metadata_op();
+    return written;
 }
 
-int delete_file(Directory *dir, DiskSpaceManager *manager, const char *filename) {
-    if (remove(filename) != 0) {
+// 删除文件或空目录
+int delete_file(Directory *cwd, DiskSpaceManager *manager, const char *path) {
+    char filename[36];
+    int result = -1;
+    pthread_rwlock_rdlock(&meta_lock);
+    Directory *dir = resolve_parent(cwd, path, filename);
+    if (!dir) {
+        pthread_rwlock_unlock(&meta_lock);
+        return -1;
+    }
+    // 删除目录时还须锁住目录自身以确认其为空, 先不加写锁查出目录对象, 两把锁都拿到后再核对
+    pthread_rwlock_rdlock(&dir->lock);
+    FileControlBlock *fcb = dir->removed ? NULL : find_file(dir, filename);
+    Directory *target = fcb && fcb->is_dir ? directory_table[fcb - inode_table] : NULL;
+    pthread_rwlock_unlock(&dir->lock);
+    if (!fcb) {
+        pthread_rwlock_unlock(&meta_lock);
+        return -1;
+    }
+    lock_directories(dir, target);
+    int slot = dir_slot(dir, filename);
+    if (dir->removed || dir->fcb[slot] != fcb || (fcb->is_dir ? directory_table[fcb - inode_table] : NULL) != target)
+        goto out; // 其间被其他线程删除或替换
+    if (target && target->file_count > 0)
+        goto out; // 只能删除空目录
+    lock_inode(fcb, 1); // 等待正在读写该文件的线程结束
+    if (open_counts[fcb - inode_table]) {
+        unlock_inode(fcb);
+        goto out; // 文件仍被打开, 零拷贝视图可能还引用着它的块
+    }
+    if (host_mirror && (target ? rmdir(host_path(path)) : remove(host_path(path))) != 0) {
         perror("删除文件失败");
+        unlock_inode(fcb);
+        goto out;
+    }
+    truncate_blocks(manager, fcb, 0);
+    dir_remove_slot(dir, slot);
+    unlock_inode(fcb);
+    if (target) {
+        __atomic_store_n(&directory_table[fcb - inode_table], NULL, __ATOMIC_RELEASE);
+        target->removed = 1;
+        target->next_retired = __atomic_load_n(&retired_dirs, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&retired_dirs, &target->next_retired, target, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+        dcache_invalidate();
+    }
+    free_inode(fcb);
+    result = 0;
+out:
+    unlock_directories(dir, target);
+    end_metadata_op();
+    return result;
+}
+
+// 在原目录内把 path 重命名为 new_name
+int rename_file(Directory *cwd, const char *path, const char *new_name) {
+    char filename[36], new_path[MAX_PATH];
+    int result = -1;
+    if (strchr(new_name, '/') || strlen(new_name) == 0 || strlen(new_name) >= 36)
+        return -1;
+    pthread_rwlock_rdlock(&meta_lock);
+    Directory *dir = resolve_parent(cwd, path, filename);
+    if (!dir) {
+        pthread_rwlock_unlock(&meta_lock);
         return -1;
     }
-    for (int i = 0; i < dir->file_count; ++i) {
-        if (strcmp(dir->fcb[i]->filename, filename) == 0) {
-            free_block(manager, dir->fcb[i]->start_block);
-            free(dir->fcb[i]);
-            for (int j = i; j < dir->file_count - 1; ++j) {
-                dir->fcb[j] = dir->fcb[j + 1];
-            }
-            dir->file_count--;
-            return 0;
+    pthread_rwlock_wrlock(&dir->lock);
+    int slot = dir_slot(dir, filename);
+    FileControlBlock *fcb = dir->fcb[slot];
+    if (dir->removed || !fcb || find_file(dir, new_name))
+        goto out; // 文件不存在或新文件名已被占用
+    const char *slash = strrchr(path, '/');
+    snprintf(new_path, sizeof(new_path), "%.*s%s", slash ? (int)(slash - path + 1) : 0, path, new_name);
+    if (host_mirror && rename(host_path(path), host_path(new_path)) != 0) {
+        perror("重命名失败");
+        goto out;
+    }
+    dir_remove_slot(dir, slot);
+    strcpy(fcb->filename, new_name);
+    dir_insert(dir, fcb);
+    if (fcb->is_dir) {
+        strcpy(directory_table[fcb - inode_table]->dirname, new_name);
+        dcache_invalidate();
+    }
+    journal_dirty(fcb, sizeof(FileControlBlock));
+    result = 0;
+out:
+    pthread_rwlock_unlock(&dir->lock);
+    end_metadata_op();
+    return result;
+}
+
+int create_directory(Directory *cwd, const char *path) {
+    char dirname[36];
+    pthread_rwlock_rdlock(&meta_lock);
+    Directory *parent = resolve_parent(cwd, path, dirname);
+    if (!parent || dir_lookup(parent, dirname)) {
+        pthread_rwlock_unlock(&meta_lock);
+        return -1;
+    }
+    Directory *new_dir = (Directory *)malloc(sizeof(Directory));
+    FileControlBlock *fcb = new_dir ? alloc_inode() : NULL;
+    if (!fcb) {
+        free(new_dir);
+        pthread_rwlock_unlock(&meta_lock);
+        return -1; // 内存或索引节点不足
+    }
+    // 分配成功后再建宿主目录, 之后只有同名竞争会失败, 届时删除刚建的宿主目录
+    if (host_mirror && mkdir(host_path(path), 0755) != 0) {
+        perror("创建目录失败");
+        free(new_dir);
+        free_inode(fcb);
+        end_metadata_op();
+        return -1;
+    }
+    strcpy(fcb->filename, dirname);
+    fcb->creation_time = time(NULL);
+    fcb->is_dir = 1;
+    fcb->parent = parent->ino;
+    init_directory(new_dir, dirname);
+    new_dir->ino = fcb - inode_table;
+    new_dir->parent = parent;
+    pthread_rwlock_wrlock(&parent->lock);
+    int ok = !parent->removed && !find_file(parent, dirname);
+    if (ok) {
+        __atomic_store_n(&directory_table[new_dir->ino], new_dir, __ATOMIC_RELEASE); // compress_cold_files 不持锁读取
+        dir_insert(parent, fcb);
+        journal_dirty(fcb, sizeof(FileControlBlock));
+    }
+    pthread_rwlock_unlock(&parent->lock);
+    if (!ok) {
+        if (host_mirror) {
+            rmdir(host_path(path));
         }
+        free_inode(fcb);
+        destroy_directory(new_dir);
     }
-    return -1;
+    end_metadata_op();
+    return ok ? 0 : -1;
 }
 
-int rename_file(Directory *dir, const char *old_name, const char *new_name) {
-    if (rename(old_name, new_name) != 0) {
-        perror("重命名失败");
+// 把文件或目录移动到另一个目录下, 只修改目录项和索引节点, 不搬动数据
+int move(Directory *cwd, const char *path, const char *dir_path) {
+    char filename[36];
+    int result = -1;
+    pthread_rwlock_rdlock(&meta_lock);
+    Directory *from = resolve_parent(cwd, path, filename);
+    Directory *to = lookup_directory(cwd, dir_path);
+    if (!from || !to) {
+        pthread_rwlock_unlock(&meta_lock);
         return -1;
     }
-    for (int i = 0; i < dir->file_count; ++i) {
-        if (strcmp(dir->fcb[i]->filename, old_name) == 0) {
-            strcpy(dir->fcb[i]->filename, new_name);
-            return 0;
+    pthread_mutex_lock(&rename_lock);
+    lock_directories(from, to);
+    int slot = dir_slot(from, filename);
+    FileControlBlock *fcb = from->fcb[slot];
+    if (from->removed || to->removed || !fcb || find_file(to, filename))
+        goto out;
+    if (fcb->is_dir) {
+        // 目录不能移到自身或其子目录下, 移动操作互斥, 各级 parent 在检查期间不会改变
+        for (Directory *d = to; d; d = d->parent) {
+            if (d == directory_table[fcb - inode_table])
+                goto out;
         }
     }
-    return -1;
+    if (host_mirror) {
+        char new_path[MAX_PATH * 2];
+        if (*host_path(dir_path)) {
+            snprintf(new_path, sizeof(new_path), "%s/%s", host_path(dir_path), filename);
+        } else {
+            strcpy(new_path, filename);
+        }
+        if (rename(host_path(path), new_path) != 0) {
+            perror("移动文件失败");
+            goto out;
+        }
+    }
+    dir_remove_slot(from, slot);
+    dir_insert(to, fcb);
+    fcb->parent = to->ino;
+    if (fcb->is_dir) {
+        __atomic_store_n(&directory_table[fcb - inode_table]->parent, to, __ATOMIC_RELEASE);
+        dcache_invalidate();
+    }
+    journal_dirty(fcb, sizeof(FileControlBlock));
+    result = 0;
+out:
+    unlock_directories(from, to);
+    pthread_mutex_unlock(&rename_lock);
+    end_metadata_op();
+    return result;
 }
 
-int create_directory(Directory *parent, const char *dirname) {
-    if (mkdir(dirname, 0755) != 0) {
-        perror("创建目录失败");
+// 打开文件, flags 取 O_RDONLY / O_WRONLY / O_RDWR, 返回句柄号, 失败返回 -1
+int open_file(Directory *cwd, const char *path, int flags) {
+    int writable = (flags & O_ACCMODE) != O_RDONLY;
+    FileControlBlock *fcb = lock_path(cwd, path, 1);
+    if (!fcb)
         return -1;
+    int fd = -1;
+    if (!fcb->is_dir && !(writable && fcb->attribute == FILE_READONLY)) {
+        pthread_mutex_lock(&open_files_lock);
+        for (int i = 0; i < MAX_OPEN_FILES; ++i) {
+            if (!open_files[i].fcb) {
+                open_files[i].fcb = fcb;
+                open_files[i].flags = flags & O_ACCMODE;
+                open_files[i].offset = 0;
+                strcpy(open_files[i].path, path);
+                fd = i;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&open_files_lock);
+    }
+    if (fd != -1) {
+        open_counts[fcb - inode_table]++;
+    }
+    unlock_inode(fcb);
+    return fd;
+}
+
+static FileHandle *get_handle(int fd) {
+    return fd >= 0 && fd < MAX_OPEN_FILES && open_files[fd].fcb ? &open_files[fd] : NULL;
+}
+
+// 在句柄锁内取出句柄当前位置并推进 advance 字节, 返回推进后的位置, 句柄无效时返回 -1
+static int handle_offset(int fd, int advance) {
+    pthread_mutex_lock(&open_files_lock);
+    FileHandle *handle = get_handle(fd);
+    int offset = handle ? (handle->offset += advance) : -1;
+    pthread_mutex_unlock(&open_files_lock);
+    return offset;
+}
+
+// 关闭句柄; 同 close(2), 其他线程不得仍在该句柄上读写, 同一句柄被重复关闭时只有一次成功
+int close_file(int fd) {
+    pthread_mutex_lock(&open_files_lock);
+    FileHandle *handle = get_handle(fd);
+    FileControlBlock *fcb = handle ? handle->fcb : NULL;
+    if (handle) {
+        handle->fcb = NULL;
     }
-    if (parent->dir_count >= MAX_DIRS)
+    pthread_mutex_unlock(&open_files_lock);
+    if (!fcb)
         return -1;
-    Directory *new_dir = (Directory *)malloc(sizeof(Directory));
-    if (!new_dir)
-        return -1; // 检查内存分配
-    strcpy(new_dir->dirname, dirname);
-    new_dir->file_count = 0;
-    new_dir->dir_count = 0;
-    parent->subdirs[parent->dir_count++] = new_dir;
+    lock_inode(fcb, 1);
+    open_counts[fcb - inode_table]--;
+    unlock_inode(fcb);
     return 0;
 }
 
-int move(const char *filename, const char *dir) {
-    char new_path[1024];                                          // 假设新路径不会超过1024个字符
-    snprintf(new_path, sizeof(new_path), "%s/%s", dir, filename); // 构造新路径
-    // 使用rename函数移动文件
-    if (rename(filename, new_path) == 0) {
-        return 0; // 成功
-    } else {
-        perror("移动文件失败");
-        return -1; // 失败
+// 按 whence (SEEK_SET / SEEK_CUR / SEEK_END) 移动句柄的当前位置, 返回新位置
+int file_seek(int fd, int offset, int whence) {
+    int size = 0;
+    if (whence == SEEK_END) { // 打开文件时先锁节点再锁句柄表, 文件大小须在句柄锁之外读取
+        pthread_mutex_lock(&open_files_lock);
+        FileHandle *handle = get_handle(fd);
+        FileControlBlock *fcb = handle ? handle->fcb : NULL;
+        pthread_mutex_unlock(&open_files_lock);
+        if (!fcb)
+            return -1;
+        lock_inode(fcb, 0);
+        size = fcb->size;
+        unlock_inode(fcb);
+    }
+    pthread_mutex_lock(&open_files_lock);
+    FileHandle *handle = get_handle(fd);
+    int result = -1;
+    if (handle) {
+        int base = whence == SEEK_CUR ? handle->offset : whence == SEEK_END ? size : 0;
+        if (base + offset >= 0) {
+            handle->offset = base + offset;
+            result = handle->offset;
+        }
+    }
+    pthread_mutex_unlock(&open_files_lock);
+    return result;
+}
+
+// 分散读: 从 offset 处依次填满各个缓冲区, 返回读取的总字节数
+int file_preadv(int fd, const struct iovec *iov, int iovcnt, int offset) {
+    FileHandle *handle = get_handle(fd);
+    if (!handle || handle->flags == O_WRONLY || offset < 0)
+        return -1;
+    int total = 0;
+    lock_inode(handle->fcb, 0);
+    for (int i = 0; i < iovcnt; ++i) {
+        int n = read_file_at(handle->fcb, offset + total, (char *)iov[i].iov_base, iov[i].iov_len);
+        total += n;
+        if (n < (int)iov[i].iov_len)
+            break; // 已到文件末尾
+    }
+    unlock_inode(handle->fcb);
+    return total;
+}
+
+// 集中写: 把各个缓冲区的内容依次写到 offset 处, 文件先一次扩展到最终大小, 返回写入的总字节数, 中途失败时返回已写入的部分
+int file_pwritev(int fd, DiskSpaceManager *manager, const struct iovec *iov, int iovcnt, int offset) {
+    FileHandle *handle = get_handle(fd);
+    if (!handle || handle->flags == O_RDONLY || offset < 0)
+        return -1;
+    int size = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        size += iov[i].iov_len;
+    }
+    int total = -1;
+    pthread_rwlock_rdlock(&meta_lock);
+    lock_inode(handle->fcb, 1);
+    if (host_mirror) {
+        int host_fd = open(host_path(handle->path), O_WRONLY);
+        if (host_fd < 0 || pwritev(host_fd, iov, iovcnt, offset) < 0) {
+            perror("写入文件失败");
+            if (host_fd >= 0) {
+                close(host_fd);
+            }
+            goto out;
+        }
+        close(host_fd);
+    }
+    // 压缩文件先还原, 否则扩展出的块会接在压缩数据之后, 随后的还原又把它们全部释放
+    if (handle->fcb->compressed_size && inflate_file(manager, handle->fcb) != 0)
+        goto out;
+    if (extend_file(manager, handle->fcb, (offset + size + BLOCK_SIZE - 1) / BLOCK_SIZE) != 0)
+        goto out;
+    total = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        int n = write_file_at(manager, handle->fcb, offset + total, (const char *)iov[i].iov_base, iov[i].iov_len);
+        if (n < 0) {
+            total = total ? total : -1; // 返回已写入的部分, 一个字节也没写入时返回 -1
+            break;
+        }
+        total += n;
+    }
+out:
+    unlock_inode(handle->fcb);
+    end_metadata_op();
+    return total;
+}
+
+int file_pread(int fd, char *buffer, int size, int offset) {
+    struct iovec iov = {buffer, (size_t)size};
+    return file_preadv(fd, &iov, 1, offset);
+}
+
+int file_pwrite(int fd, DiskSpaceManager *manager, const char *data, int size, int offset) {
+    struct iovec iov = {(void *)data, (size_t)size};
+    return file_pwritev(fd, manager, &iov, 1, offset);
+}
+
+// 从当前位置读写并推进当前位置
+int file_read(int fd, char *buffer, int size) {
+    int offset = handle_offset(fd, 0);
+    int n = offset >= 0 ? file_pread(fd, buffer, size, offset) : -1;
+    if (n > 0) {
+        handle_offset(fd, n);
+    }
+    return n;
+}
+
+int file_write(int fd, DiskSpaceManager *manager, const char *data, int size) {
+    int offset = handle_offset(fd, 0);
+    int n = offset >= 0 ? file_pwrite(fd, manager, data, size, offset) : -1;
+    if (n > 0) {
+        handle_offset(fd, n);
+    }
+    return n;
+}
+
+// 零拷贝读取: 把 offset 处的数据以块存储中的只读视图返回, 视图止于所在区段末尾且不超过 size 字节
+// 返回视图长度, 到达文件末尾返回 0; pread 后端没有可引用的内存, 返回 -1, 调用者应改用 file_pread
+// 视图在句柄关闭或文件被再次写入之前有效, 文件打开期间不能被删除, 其块不会被挪作他用
+int file_read_view(int fd, int offset, int size, const char **view) {
+    FileHandle *handle = get_handle(fd);
+    if (!handle || handle->flags == O_WRONLY || offset < 0 || pread_backend)
+        return -1;
+    FileControlBlock *fcb = handle->fcb;
+    int n = 0;
+    lock_inode(fcb, 0);
+    if (fcb->compressed_size) {
+        unlock_inode(fcb);
+        return -1; // 块存储中是压缩数据
+    }
+    if (size > fcb->size - offset)
+        size = fcb->size - offset;
+    int file_pos = 0;
+    for (int i = 0; i < fcb->extent_count && size > 0; ++i) {
+        Extent *extent = file_extent(fcb, i);
+        int extent_bytes = extent->count * BLOCK_SIZE;
+        if (offset < file_pos + extent_bytes) {
+            int skip = offset - file_pos;
+            n = extent_bytes - skip < size ? extent_bytes - skip : size;
+            // 缓存中尚未写回的修改先落到块存储, 视图才能看到最新内容
+            cache_writeback(extent->start + skip / BLOCK_SIZE, (skip + n - 1) / BLOCK_SIZE - skip / BLOCK_SIZE + 1);
+            *view = disk_view + (size_t)extent->start * BLOCK_SIZE + skip;
+            break;
+        }
+        file_pos += extent_bytes;
+    }
+    unlock_inode(fcb);
+    return n;
+}
+
+// 压缩 idle 秒以来未被读写的文件, 返回省下的块数
+// 逐个目录扫描, 每处理一批文件提交一次事务, 以免单个事务撑满日志组
+int compress_cold_files(DiskSpaceManager *manager, int idle) {
+    time_t now = time(NULL);
+    int saved = 0;
+    for (int d = -1; d < super_block->inode_count; ++d) {
+        // 不持父目录锁, 表项可能正被 create_directory/delete_file 改写, 原子读取;
+        // 删除的目录对象卸载时才释放, 指针始终有效, 加锁后再看 removed
+        Directory *dir = d < 0 ? root_dir : __atomic_load_n(&directory_table[d], __ATOMIC_ACQUIRE);
+        if (!dir)
+            continue;
+        for (int i = 0, done = 0; !done;) {
+            pthread_rwlock_rdlock(&meta_lock);
+            pthread_rwlock_rdlock(&dir->lock);
+            for (int batch = 0; batch < 64; ++i) {
+                if (dir->removed || i >= dir->capacity) {
+                    done = 1;
+                    break;
+                }
+                FileControlBlock *fcb = dir->fcb[i];
+                if (!fcb || fcb->is_dir || now - last_access[fcb - inode_table] < idle)
+                    continue;
+                lock_inode(fcb, 1);
+                saved += compress_file(manager, fcb);
+                unlock_inode(fcb);
+                batch++;
+            }
+            pthread_rwlock_unlock(&dir->lock);
+            end_metadata_op();
+        }
+    }
+    return saved;
+}
+
+// 空间统计: 文件按未去重、未压缩计算应占的块数与实际占用的块数之比
+void display_space_stats(DiskSpaceManager *manager) {
+    long logical = 0, compressed_saved = 0, dedup_saved = 0, used = 0;
+    for (int i = 0; i < super_block->inode_count; ++i) {
+        FileControlBlock *fcb = &inode_table[i];
+        if (fcb->filename[0] && !fcb->is_dir) {
+            int blocks = (fcb->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+            logical += blocks;
+            if (fcb->compressed_size) {
+                compressed_saved += blocks - fcb->block_count;
+            }
+        }
+    }
+    for (int w = 0; w < manager->word_count; ++w) {
+        used += __builtin_popcountll(manager->bitmap[w]);
+    }
+    used -= (long)manager->word_count * WORD_BITS - manager->block_count; // 末尾补齐的位不算
+    if (dedup.refs) {
+        for (int b = 0; b < manager->block_count; ++b) {
+            dedup_saved += dedup.refs[b] > 1 ? dedup.refs[b] - 1 : 0;
+        }
+    }
+    printf("空间统计: 文件数据 %ld 块, 实际占用 %ld 块, 去重省下 %ld 块, 压缩省下 %ld 块, 节省 %.2f%%\n",
+           logical, used, dedup_saved, compressed_saved, logical ? 100.0 * (logical - used) / logical : 0.0);
+    if (dedup.refs) {
+        printf("去重统计: 查重 %ld 块, 命中 %ld 块\n", dedup.lookups, dedup.hits);
+    }
+}
+
+static double elapsed(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// 空间基准: 创建 ops 个内容只有 16 种的小文件并逐个读取, 再压缩全部文件后重读一遍
+// 分别以带 -D 和不带 -D 运行, 比较去重对空间和吞吐量的影响
+void benchmark_space(Directory *root, DiskSpaceManager *manager, int ops) {
+    int saved_mirror = host_mirror;
+    char name[36], data[3 * BLOCK_SIZE], buffer[3 * BLOCK_SIZE];
+    struct timespec start;
+    host_mirror = 0;
+    printf("去重%s\n", dedup.refs ? "已启用" : "未启用");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < ops; ++i) {
+        int kind = i % 16;
+        for (int j = 0; j < (int)sizeof(data); ++j) {
+            data[j] = "abcdefgh"[(j / (kind + 1)) % 8];
+        }
+        snprintf(name, sizeof(name), "space_%d.dat", i);
+        create_file(root, manager, name, data, sizeof(data), FILE_NORMAL);
+    }
+    double seconds = elapsed(&start);
+    printf("创建 %d 个文件: %.3f 秒, %.0f 次/秒\n", ops, seconds, ops / seconds);
+    for (int pass = 0; pass < 2; ++pass) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < ops; ++i) {
+            snprintf(name, sizeof(name), "space_%d.dat", i);
+            read_file(root, name, 0, buffer, sizeof(buffer));
+        }
+        seconds = elapsed(&start);
+        printf("%s读取 %d 个文件: %.3f 秒, %.0f 次/秒\n", pass ? "压缩后" : "", ops, seconds, ops / seconds);
+        display_space_stats(manager);
+        if (pass == 0) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            int saved = compress_cold_files(manager, 0);
+            printf("压缩全部文件: %.3f 秒, 省下 %d 块\n", elapsed(&start), saved);
+        }
+    }
+    for (int i = 0; i < ops; ++i) {
+        snprintf(name, sizeof(name), "space_%d.dat", i);
+        delete_file(root, manager, name);
+    }
+    host_mirror = saved_mirror;
+}
+
+// 磁盘调度基准: 以固定种子生成同一串文件操作, 分别在顺序/随机放置与四种调度算法下运行
+// 先创建 ops / 4 个文件, 其余操作在读取、改写、删除、重建之间随机选择, 报告各类操作的平均模拟延迟
+void benchmark_disk(Directory *root, DiskSpaceManager *manager, int ops) {
+    const char *placements[] = {"顺序", "随机"};
+    char name[36], data[8 * BLOCK_SIZE];
+    int files = ops / 4 > 0 ? ops / 4 : 1, saved_mirror = host_mirror;
+    host_mirror = 0;
+    printf("放置  调度    创建(ms)  读取(ms)  改写(ms)  删除(ms)  平均寻道长度  模拟耗时(s)\n");
+    for (int placement = 0; placement < 2; ++placement) {
+        for (int policy = SCHED_FCFS; policy <= SCHED_CSCAN; ++policy) {
+            long latency[4] = {0}, count[4] = {0};
+            random_placement = placement;
+            cache_flush();
+            cache_invalidate(0, manager->block_count);
+            disk_init(manager->block_count, (SchedPolicy)policy);
+            srand(1);
+            for (int i = 0; i < ops; ++i) {
+                int op = i < files ? 0 : rand() % 4;
+                int file = i < files ? i : rand() % files;
+                int size = (1 + rand() % 8) * BLOCK_SIZE - rand() % BLOCK_SIZE;
+                long before = io_wait_us;
+                int ok;
+                snprintf(name, sizeof(name), "disk_%d.dat", file);
+                memset(data, 'a' + file % 26, size);
+                switch (op) {
+                case 0:
+                    ok = create_file(root, manager, name, data, size, FILE_NORMAL) == 0;
+                    break;
+                case 1:
+                    ok = read_file(root, name, 0, data, sizeof(data)) >= 0;
+                    break;
+                case 2:
+                    ok = write_file(root, manager, name, size / 2, data, size / 2) >= 0;
+                    break;
+                default:
+                    ok = delete_file(root, manager, name) == 0;
+                    break;
+                }
+                if (ok) {
+                    latency[op] += io_wait_us - before;
+                    count[op]++;
+                }
+            }
+            for (int i = 0; i < files; ++i) {
+                snprintf(name, sizeof(name), "disk_%d.dat", i);
+                delete_file(root, manager, name);
+            }
+            cache_flush();
+            printf("%s  %-6s", placements[placement], sched_names[policy]);
+            for (int k = 0; k < 4; ++k) {
+                printf("  %8.3f", count[k] ? latency[k] / 1000.0 / count[k] : 0.0);
+            }
+            printf("  %12.2f  %11.3f\n", 1.0 * sim_disk.tracks / (sim_disk.requests ? sim_disk.requests : 1), sim_disk.clock_us / 1e6);
+        }
+    }
+    random_placement = 0;
+    sim_disk.enabled = 0;
+    host_mirror = saved_mirror;
+}
+
+// 元数据操作基准: 分别逐个提交和按组提交, 创建再删除 ops 个小文件
+void benchmark_journal(Directory *dir, DiskSpaceManager *manager, int ops) {
+    int group_sizes[2] = {1, journal.group_size > 1 ? journal.group_size : JOURNAL_GROUP};
+    int saved_mirror = host_mirror, saved_group = journal.group_size;
+    host_mirror = 0;
+    if (!journal.enabled) {
+        printf("未指定磁盘映像, 日志未启用, 以下结果不含日志开销\n");
+    }
+    for (int g = 0; g < 2; ++g) {
+        char name[36];
+        struct timespec start, end;
+        journal_flush();
+        journal.group_size = group_sizes[g];
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < ops; ++i) {
+            snprintf(name, sizeof(name), "bench_%d.dat", i);
+            create_file(dir, manager, name, name, strlen(name), FILE_NORMAL);
+        }
+        for (int i = 0; i < ops; ++i) {
+            snprintf(name, sizeof(name), "bench_%d.dat", i);
+            delete_file(dir, manager, name);
+        }
+        journal_flush();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("每组 %-4d 个事务: %d 次元数据操作用时 %.3f 秒, %.0f 次/秒\n",
+               group_sizes[g], 2 * ops, seconds, 2 * ops / seconds);
+    }
+    host_mirror = saved_mirror;
+    journal.group_size = saved_group;
+}
+
+// 回归基准: 每个规模先创建 ops / 4 个 1~4 块的文件, 再以种子随机执行 ops 次读取、改写、删除或重建, 最后删除全部文件
+// 创建阶段与混合阶段分别输出一条结果, 对不存在的文件读写、对已存在的文件重建计入 failed_ops
+void benchmark_regression(Directory *root, DiskSpaceManager *manager, int max_scale, uint64_t seed) {
+    const char *workloads[] = {"create", "mixed"};
+    long failed_ops = 0;
+    BenchCounter counters[] = {{"bitmap_scans", &bitmap_scans}, {"bitmap_words", &bitmap_words}, {"block_allocs", &block_allocs}, {"failed_ops", &failed_ops}};
+    BenchHistogram histogram;
+    char name[36], data[4 * BLOCK_SIZE];
+    int saved_mirror = host_mirror;
+    host_mirror = 0;
+    for (int i = 0; i < BENCH_SCALES; ++i) {
+        int ops = bench_scale(max_scale, i), files = ops / 4 > 0 ? ops / 4 : 1;
+        bench_seed(seed);
+        for (int phase = 0; phase < 2; ++phase) {
+            int count = phase ? ops : files;
+            bench_reset(&histogram, counters, 4);
+            long start = bench_now_ns();
+            for (int j = 0; j < count; ++j) {
+                int op = phase ? bench_range(4) : 0;
+                int file = phase ? bench_range(files) : j;
+                int size = (1 + bench_range(4)) * BLOCK_SIZE - bench_range(BLOCK_SIZE);
+                snprintf(name, sizeof(name), "regress_%d.dat", file);
+                memset(data, 'a' + file % 26, size);
+                long t = bench_now_ns();
+                int ok;
+                switch (op) {
+                case 0:
+                    ok = create_file(root, manager, name, data, size, FILE_NORMAL) == 0;
+                    break;
+                case 1:
+                    ok = read_file(root, name, 0, data, sizeof(data)) >= 0;
+                    break;
+                case 2:
+                    ok = write_file(root, manager, name, size / 2, data, size / 2) >= 0;
+                    break;
+                default:
+                    ok = delete_file(root, manager, name) == 0;
+                    break;
+                }
+                bench_record(&histogram, bench_now_ns() - t);
+                failed_ops += !ok;
+            }
+            journal_flush();
+            bench_report("file_system", workloads[phase], ops, seed, count, bench_now_ns() - start, &histogram, counters, 4);
+        }
+        for (int j = 0; j < files; ++j) {
+            snprintf(name, sizeof(name), "regress_%d.dat", j);
+            delete_file(root, manager, name);
+        }
+        journal_flush();
+    }
+    host_mirror = saved_mirror;
+}
+
+typedef struct {
+    Directory *root;
+    DiskSpaceManager *manager;
+    int id;
+    int ops;
+    int errors;
+    int shared; // 是否与其他线程共用一个目录
+} StressWorker;
+
+// 压力测试线程: 在自己的目录或共用目录下反复创建、读取、删除文件, 共用目录时文件名带线程号以免冲突
+static void *stress_worker(void *arg) {
+    StressWorker *worker = (StressWorker *)arg;
+    char path[MAX_PATH], data[BLOCK_SIZE * 2], buffer[BLOCK_SIZE * 2];
+    for (int i = 0; i < worker->ops; ++i) {
+        int size = 64 + (worker->id * 131 + i * 37) % (int)(sizeof(data) - 64);
+        memset(data, 'a' + (worker->id + i) % 26, size);
+        if (worker->shared) {
+            snprintf(path, sizeof(path), "/stress_shared/file_%d_%d.dat", worker->id, i);
+        } else {
+            snprintf(path, sizeof(path), "/stress_%d/file_%d.dat", worker->id, i);
+        }
+        if (create_file(worker->root, worker->manager, path, data, size, FILE_NORMAL) != 0 ||
+            read_file(worker->root, path, 0, buffer, sizeof(buffer)) != size ||
+            memcmp(buffer, data, size) != 0 ||
+            delete_file(worker->root, worker->manager, path) != 0) {
+            worker->errors++;
+        }
+    }
+    free(txn.ranges);
+    return NULL;
+}
+
+// 线程数从 1 倍增到 max_threads, 每个线程执行 ops 轮创建/读取/删除, 报告吞吐量及相对单线程的加速比
+static void stress_rounds(Directory *root, DiskSpaceManager *manager, int max_threads, int ops, int shared) {
+    StressWorker *workers = (StressWorker *)calloc(max_threads, sizeof(StressWorker));
+    pthread_t *threads = (pthread_t *)malloc(max_threads * sizeof(pthread_t));
+    double base = 0;
+    printf("%s\n", shared ? "所有线程共用一个目录:" : "各线程使用各自的目录:");
+    for (int n = 1;; n = n * 2 < max_threads ? n * 2 : max_threads) {
+        struct timespec start, end;
+        int errors = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < n; ++i) {
+            workers[i] = (StressWorker){root, manager, i, ops, 0, shared};
+            pthread_create(&threads[i], NULL, stress_worker, &workers[i]);
+        }
+        for (int i = 0; i < n; ++i) {
+            pthread_join(threads[i], NULL);
+            errors += workers[i].errors;
+        }
+        journal_flush();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        double throughput = 3.0 * n * ops / seconds;
+        if (n == 1) {
+            base = throughput;
+        }
+        printf("%3d 个线程: %d 次操作用时 %.3f 秒, %.0f 次/秒, 加速比 %.2f, 失败 %d\n",
+               n, 3 * n * ops, seconds, throughput, throughput / base, errors);
+        if (n == max_threads)
+            break;
     }
+    free(workers);
+    free(threads);
+}
+
+// 多线程压力基准: 先让各线程使用各自的目录, 再让所有线程共用一个目录, 后者衡量同一目录锁上的争用
+void benchmark_stress(Directory *root, DiskSpaceManager *manager, int max_threads, int ops) {
+    int saved_mirror = host_mirror;
+    host_mirror = 0;
+    if (max_threads < 1)
+        max_threads = 1;
+    char path[MAX_PATH];
+    for (int i = 0; i < max_threads; ++i) {
+        snprintf(path, sizeof(path), "/stress_%d", i);
+        create_directory(root, path);
+    }
+    create_directory(root, "/stress_shared");
+    stress_rounds(root, manager, max_threads, ops, 0);
+    stress_rounds(root, manager, max_threads, ops, 1);
+    for (int i = 0; i < max_threads; ++i) {
+        snprintf(path, sizeof(path), "/stress_%d", i);
+        delete_file(root, manager, path);
+    }
+    delete_file(root, manager, "/stress_shared");
+    host_mirror = saved_mirror;
+}
+
+static int compare_filename(const void *a, const void *b) {
+    return strcmp((*(FileControlBlock **)a)->filename, (*(FileControlBlock **)b)->filename);
 }
 
 void display_file_list(Directory *dir) {
-    printf("文件列表:\n");
+    // 散列表无序, 先收集表项再按文件名排序输出
+    pthread_rwlock_rdlock(&dir->lock);
+    FileControlBlock **files = (FileControlBlock **)malloc((dir->file_count + 1) * sizeof(FileControlBlock *));
+    int n = 0;
+    for (int i = 0; i < dir->capacity; ++i) {
+        if (dir->fcb[i]) {
+            files[n++] = dir->fcb[i];
+        }
+    }
+    qsort(files, n, sizeof(FileControlBlock *), compare_filename);
+    printf("%s 文件列表:\n", dir->dirname);
     printf("+---------------+---------------+---------------+-----------------------+---------------+\n");
     printf("|  序号         |  名称         |  大小         |  创建时间             |  属性         |\n");
     printf("+---------------+---------------+---------------+-----------------------+---------------+\n");
-    for (int i = 0; i < dir->file_count; ++i) {
+    for (int i = 0; i < n; ++i) {
         char creation_date[20];
-        struct tm *tm_info = gmtime(&dir->fcb[i]->creation_time); // 使用 gmtime 而不是 localtime
+        struct tm *tm_info = gmtime(&files[i]->creation_time); // 使用 gmtime 而不是 localtime
         if (tm_info != NULL) {
             int size = strftime(creation_date, sizeof(creation_date), "%Y-%m-%d %H:%M:%S", tm_info);
             if (size < 0) {
@@ -190,34 +3108,136 @@ void display_file_list(Directory *dir) {
             strcpy(creation_date, "未知时间");
         }
         const char *attributes[] = {"普通文件", "只读", "隐藏", "系统文件"};
+        const char *attribute = files[i]->is_dir ? "目录" : attributes[files[i]->attribute];
         printf("|  %-12d	", i + 1);
-        printf("|  %-12s	", dir->fcb[i]->filename);
-        printf("|  %-12d	", dir->fcb[i]->size);
+        printf("|  %-12s	", files[i]->filename);
+        printf("|  %-12d	", files[i]->size);
         printf("|  %-12s	", creation_date);
-        printf("|  %-12s	", attributes[dir->fcb[i]->attribute]);
+        printf("|  %-12s	", attribute);
         printf("|\n");
     }
     printf("+---------------+---------------+---------------+-----------------------+---------------+\n");
+    pthread_rwlock_unlock(&dir->lock);
+    free(files);
 }
 
-int main() {
+int main(int argc, char *argv[]) {
     DiskSpaceManager manager;
-    Directory root = {"根目录", {0}, 0, {0}, 0};
-    init_disk_space_manager(&manager);
+    Directory root;
+    const char *image_path = NULL;
+    int block_count = BLOCK_COUNT, inode_count = INODE_COUNT;
+    int group_size = JOURNAL_GROUP, bench_ops = 0, stress_threads = 0, space_ops = 0, disk_ops = 0;
+    int policy = -1, regress_scale = 0;
+    uint64_t seed = 1;
+    const char *output = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:npb:I:g:B:T:DZ:s:L:R:S:o:")) != -1) {
+        switch (opt) {
+        case 'i':
+            image_path = optarg;
+            break;
+        case 'n':
+            host_mirror = 0;
+            break;
+        case 'p':
+            pread_backend = 1;
+            break;
+        case 'b':
+            block_count = atoi(optarg);
+            break;
+        case 'I':
+            inode_count = atoi(optarg);
+            break;
+        case 'g':
+            group_size = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        case 'B':
+            bench_ops = atoi(optarg);
+            break;
+        case 'T':
+            stress_threads = atoi(optarg);
+            break;
+        case 'D':
+            dedup_enabled = 1;
+            break;
+        case 'Z':
+            space_ops = atoi(optarg);
+            break;
+        case 's': { // 调度算法, 字母与 disk.c 的菜单相同, 依次对应 SchedPolicy 的各项
+            const char *letters = "fsSc", *letter = optarg[0] && !optarg[1] ? strchr(letters, optarg[0]) : NULL;
+            if (!letter)
+                goto usage; // 未知的算法字母
+            policy = letter - letters;
+            break;
+        }
+        case 'L':
+            disk_ops = atoi(optarg);
+            break;
+        case 'R':
+            regress_scale = atoi(optarg);
+            break;
+        case 'S':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+        usage:
+            fprintf(stderr, "用法: %s [-i 磁盘映像] [-n] [-p] [-b 块数] [-I 索引节点数] [-g 每组事务数] [-B 基准操作数] [-T 压力测试线程数] [-D] [-Z 空间基准文件数] "
+                            "[-s f|s|S|c 模拟磁盘调度算法] [-L 调度基准操作数] [-R 基准最大规模] [-S 种子] [-o 结果文件(.json/.csv)]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (!image_path)
+        pread_backend = 0; // 匿名映像只能经内存映射访问
+    if (mount_disk(&manager, &root, image_path, block_count, inode_count, group_size) != 0)
+        return 1;
+    if (policy != -1) {
+        disk_init(manager.block_count, (SchedPolicy)policy);
+    }
+    if (regress_scale > 0) {
+        if (bench_open(output) == 0) {
+            benchmark_regression(&root, &manager, regress_scale, seed);
+            bench_close();
+        }
+        unmount_disk();
+        return 0;
+    }
+    if (disk_ops > 0) {
+        benchmark_disk(&root, &manager, disk_ops);
+        unmount_disk();
+        return 0;
+    }
+    if (space_ops > 0) {
+        benchmark_space(&root, &manager, space_ops);
+        unmount_disk();
+        return 0;
+    }
+    if (stress_threads > 0) {
+        benchmark_stress(&root, &manager, stress_threads, bench_ops > 0 ? bench_ops : 10000);
+        unmount_disk();
+        return 0;
+    }
+    if (bench_ops > 0) {
+        benchmark_journal(&root, &manager, bench_ops);
+        unmount_disk();
+        return 0;
+    }
     char choice;
-    char filename[36], data[BLOCK_SIZE], buffer[BLOCK_SIZE];
+    char filename[MAX_PATH], data[BLOCK_SIZE * MAX_EXTENTS], buffer[BLOCK_SIZE * MAX_EXTENTS];
     FileAttribute attribute;
     while (1) {
-        printf(" 文件系统命令菜单:\033[32mc\033[0m:创建文件 \033[36mr\033[0m:读取文件 \033[35md\033[0m:删除文件 "
-               "\033[34mR\033[0m:重命名文件 \033[32mC\033[0m:创建目录 \033[36ms\033[0m:显示文件列表 \033[36mm\033[0m:移动文件\n");
+        printf(" 文件系统命令菜单:\033[32mc\033[0m:创建文件 \033[36mr\033[0m:读取文件 \033[33mw\033[0m:写入文件 \033[35md\033[0m:删除文件 "
+               "\033[34mR\033[0m:重命名文件 \033[32mC\033[0m:创建目录 \033[36ms\033[0m:显示文件列表 \033[36mm\033[0m:移动文件 \033[33mt\033[0m:缓存与日志统计 \033[35mz\033[0m:压缩冷文件 \033[31mq\033[0m:退出\n");
         printf("请输入您的选择: ");
         scanf("%s", &choice);
         switch (choice) {
         case 'c': {
-            printf("请输入文件名 (格式: name.ext): ");
-            scanf("%s", filename);
+            printf("请输入文件路径 (格式: /dir/name.ext): ");
+            scanf("%255s", filename);
             printf("请输入文件内容: ");
-            scanf("%s", data);
+            scanf("%4095s", data);
             printf("选择文件属性 (0: 普通文件, 1: 只读文件, 2: 隐藏文件, 3: 系统文件): ");
             int attr;
             scanf("%d", &attr);
@@ -230,18 +3250,47 @@ int main() {
             break;
         }
         case 'r': {
-            printf("请输入文件名: ");
-            scanf("%s", filename);
-            if (read_file(&root, filename, buffer, BLOCK_SIZE) >= 0) {
-                printf("文件内容: %s\n", buffer);
-            } else {
+            printf("请输入文件路径: ");
+            scanf("%255s", filename);
+            int fd = open_file(&root, filename, O_RDONLY);
+            if (fd < 0) {
                 printf("文件未找到!\n");
+                break;
+            }
+            // 直接输出块存储中的数据, pread 后端时退回到拷贝读取
+            printf("文件内容: ");
+            for (int offset = 0, n;; offset += n) {
+                const char *view = buffer;
+                n = file_read_view(fd, offset, sizeof(buffer), &view);
+                if (n < 0) {
+                    n = file_pread(fd, buffer, sizeof(buffer), offset);
+                }
+                if (n <= 0)
+                    break;
+                fwrite(view, 1, n, stdout);
+            }
+            printf("\n");
+            close_file(fd);
+            break;
+        }
+        case 'w': {
+            printf("请输入文件路径: ");
+            scanf("%255s", filename);
+            int offset;
+            printf("请输入写入位置: ");
+            scanf("%d", &offset);
+            printf("请输入写入内容: ");
+            scanf("%4095s", data);
+            if (write_file(&root, &manager, filename, offset, data, strlen(data)) >= 0) {
+                printf("文件写入成功!\n");
+            } else {
+                printf("文件写入失败!\n");
             }
             break;
         }
         case 'd': {
-            printf("请输入文件名: ");
-            scanf("%s", filename);
+            printf("请输入文件路径: ");
+            scanf("%255s", filename);
             if (delete_file(&root, &manager, filename) == 0) {
                 printf("文件删除成功!\n");
             } else {
@@ -250,8 +3299,8 @@ int main() {
             break;
         }
         case 'R': {
-            printf("请输入旧文件名: ");
-            scanf("%s", filename);
+            printf("请输入文件路径: ");
+            scanf("%255s", filename);
             char new_name[36];
             printf("请输入新文件名: ");
             scanf("%s", new_name);
@@ -263,9 +3312,9 @@ int main() {
             break;
         }
         case 'C': {
-            printf("请输入目录名: ");
-            char dirname[32];
-            scanf("%s", dirname);
+            printf("请输入目录路径: ");
+            char dirname[MAX_PATH];
+            scanf("%255s", dirname);
             if (create_directory(&root, dirname) == 0) {
                 printf("目录创建成功!\n");
             } else {
@@ -274,23 +3323,48 @@ int main() {
             break;
         }
         case 's': {
-            display_file_list(&root);
+            char dir_path[MAX_PATH];
+            printf("请输入目录路径 (/ 为根目录): ");
+            scanf("%255s", dir_path);
+            Directory *dir = lookup_directory(&root, dir_path);
+            if (dir) {
+                display_file_list(dir);
+            } else {
+                printf("目录未找到!\n");
+            }
             break;
         }
         case 'm': {
-            char new_path[1024];
-            printf("请输入文件名: ");
-            scanf("%s", filename);
-            char dir_name[36];
-            printf("请输入目录名: ");
-            scanf("%s", dir_name);
-            if (move(filename, dir_name) == 0) {
+            printf("请输入文件路径: ");
+            scanf("%255s", filename);
+            char dir_name[MAX_PATH];
+            printf("请输入目标目录路径: ");
+            scanf("%255s", dir_name);
+            if (move(&root, filename, dir_name) == 0) {
                 printf("文件移动成功!\n");
             } else {
                 printf("文件移动失败!\n");
             }
             break;
         }
+        case 't': {
+            display_cache_stats();
+            display_journal_stats();
+            display_space_stats(&manager);
+            display_disk_stats();
+            break;
+        }
+        case 'z': {
+            int idle;
+            printf("请输入空闲秒数 (压缩此后未被读写的文件): ");
+            scanf("%d", &idle);
+            printf("压缩完成, 省下 %d 块\n", compress_cold_files(&manager, idle));
+            break;
+        }
+        case 'q': {
+            unmount_disk();
+            return 0;
+        }
         default:
             printf("无效选择，请重新输入.\n");
         }
@@ -4,8 +4,10 @@
 // description: 内存管理
 //**********************************/
 
+#include "bench.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #define MEMORY_SIZE 65536 // 假设内存大小为64MB
 
@@ -19,10 +21,18 @@ typedef struct SubAreaNode {
 } SubAreaNode;
 
 SubAreaNode *head = NULL; // 定义全局的头指针
+int quiet = 0;            // 基准测试时不输出每次分配与回收的信息
+
+// 插桩计数器
+long fitSearches = 0;   // 适配查找次数
+long fitSteps = 0;      // 适配查找访问的分区数
+long nodeAllocs = 0;    // 新建的分区节点数
+long allocFailures = 0; // 分配失败次数
 
 // 初始化内存分区链表
 void initializeMemory() {
     head = (SubAreaNode *)malloc(sizeof(SubAreaNode));
+    COUNT(nodeAllocs, 1);
     head->address = 0;
     head->size = MEMORY_SIZE;
     head->state = 0; // 初始状态为空闲
@@ -55,7 +65,9 @@ void displayMemory() {
 // 查找合适的分区（首次适配策略）
 SubAreaNode *findFirstFit(int size) {
     SubAreaNode *current = head;
+    COUNT(fitSearches, 1);
     while (current) {
+        COUNT(fitSteps, 1);
         if (current->state == 0 && current->size >= size) {
             return current;
         }
@@ -68,7 +80,9 @@ SubAreaNode *findFirstFit(int size) {
 SubAreaNode *findBestFit(int size) {
     SubAreaNode *current = head;
     SubAreaNode *best = NULL;
+    COUNT(fitSearches, 1);
     while (current) {
+        COUNT(fitSteps, 1);
         if (current->state == 0 && current->size >= size) {
             if (best == NULL || current->size < best->size) {
                 best = current;
@@ -83,7 +97,9 @@ SubAreaNode *findBestFit(int size) {
 SubAreaNode *findWorstFit(int size) {
     SubAreaNode *current = head;
     SubAreaNode *worst = NULL;
+    COUNT(fitSearches, 1);
     while (current) {
+        COUNT(fitSteps, 1);
         if (current->state == 0 && current->size >= size) {
             if (worst == NULL || current->size > worst->size) {
                 worst = current;
@@ -98,12 +114,15 @@ SubAreaNode *findWorstFit(int size) {
 int allocate(SubAreaNode *(*findFit)(int), int taskNo, int size) {
     SubAreaNode *fit = findFit(size);
     if (!fit) {
-        printf("内存分配失败: 没有足够的空间为作业%d分配%dKB内存。\n", taskNo, size);
+        COUNT(allocFailures, 1);
+        if (!quiet)
+            printf("内存分配失败: 没有足够的空间为作业%d分配%dKB内存。\n", taskNo, size);
         return -1; // 内存分配失败
     }
     // 判断是否需要分割
     if (fit->size > size) {
         SubAreaNode *newNode = (SubAreaNode *)malloc(sizeof(SubAreaNode));
+        COUNT(nodeAllocs, 1);
         newNode->address = fit->address + size;
         newNode->size = fit->size - size;
         newNode->state = 0;
@@ -119,7 +138,8 @@ int allocate(SubAreaNode *(*findFit)(int), int taskNo, int size) {
     // 分配内存
     fit->state = 1;
     fit->taskNo = taskNo;
-    printf("已为作业%d分配%dKB内存。\n", taskNo, size);
+    if (!quiet)
+        printf("已为作业%d分配%dKB内存。\n", taskNo, size);
     return 0; // 内存分配成功
 }
 
@@ -138,8 +158,9 @@ int deallocate(int taskNo) {
                 if (current->next) {
                     current->next->prior = current->prior;
                 }
+                SubAreaNode *prior = current->prior;
                 free(current);
-                current = current->prior;
+                current = prior;
             }
             // 合并与后一个空闲块
             if (current->next && current->next->state == 0) {
@@ -151,16 +172,90 @@ int deallocate(int taskNo) {
                 }
                 free(temp);
             }
-            printf("已释放作业%d占用的内存。\n", taskNo);
+            if (!quiet)
+                printf("已释放作业%d占用的内存。\n", taskNo);
             return 0; // 内存回收成功
         }
         current = current->next;
     }
-    printf("内存回收失败: 未找到作业%d的内存分区。\n", taskNo);
+    if (!quiet)
+        printf("内存回收失败: 未找到作业%d的内存分区。\n", taskNo);
     return -1; // 内存回收失败
 }
 
-int main() {
+// 释放整个分区链表
+void releaseMemory() {
+    while (head) {
+        SubAreaNode *next = head->next;
+        free(head);
+        head = next;
+    }
+}
+
+// 基准测试: 三种适配策略各以同一种子运行 ops 次操作, 60% 为分配 1~2048KB, 其余回收一个随机的在用作业
+void benchmark(int maxScale, uint64_t seed) {
+    const char *names[] = {"first_fit", "best_fit", "worst_fit"};
+    SubAreaNode *(*fits[])(int) = {findFirstFit, findBestFit, findWorstFit};
+    BenchCounter counters[] = {{"fit_searches", &fitSearches}, {"fit_steps", &fitSteps}, {"node_allocs", &nodeAllocs}, {"alloc_failures", &allocFailures}};
+    BenchHistogram histogram;
+    quiet = 1;
+    for (int i = 0; i < BENCH_SCALES; ++i) {
+        int ops = bench_scale(maxScale, i);
+        int *live = (int *)malloc(ops * sizeof(int));
+        for (int f = 0; f < 3; ++f) {
+            int liveCount = 0, taskNo = 0;
+            bench_reset(&histogram, counters, 4);
+            bench_seed(seed);
+            initializeMemory();
+            long start = bench_now_ns();
+            for (int op = 0; op < ops; ++op) {
+                int size = 1 + bench_range(2048), victim = bench_range(liveCount > 0 ? liveCount : 1);
+                long t = bench_now_ns();
+                if (liveCount == 0 || bench_range(10) < 6) {
+                    if (allocate(fits[f], ++taskNo, size) == 0) {
+                        live[liveCount++] = taskNo;
+                    }
+                } else {
+                    deallocate(live[victim]);
+                    live[victim] = live[--liveCount];
+                }
+                bench_record(&histogram, bench_now_ns() - t);
+            }
+            bench_report("mem", names[f], ops, seed, ops, bench_now_ns() - start, &histogram, counters, 4);
+            releaseMemory();
+        }
+        free(live);
+    }
+    quiet = 0;
+}
+
+int main(int argc, char *argv[]) {
+    int maxScale = 0, opt;
+    uint64_t seed = 1;
+    const char *output = NULL;
+    while ((opt = getopt(argc, argv, "R:S:o:")) != -1) {
+        switch (opt) {
+        case 'R':
+            maxScale = atoi(optarg);
+            break;
+        case 'S':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            fprintf(stderr, "用法: %s [-R 基准最大规模] [-S 种子] [-o 结果文件(.json/.csv)]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (maxScale > 0) {
+        if (bench_open(output) != 0)
+            return 1;
+        benchmark(maxScale, seed);
+        bench_close();
+        return 0;
+    }
     printf("\n模拟首次适应算法：\n");
     initializeMemory();
     displayMemory();
@@ -3,9 +3,18 @@
 // data: 2024.12.11
 // description: 进程调度 SJF
 //**********************************/
+#define _GNU_SOURCE
+#include "bench.h"
+#include <sched.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 void display_banner() {
@@ -28,6 +37,10 @@ typedef struct pcd {
     int rtime;
     int pid;
     int ppid;
+    int arrive;         // 进入就绪队列时的模拟时钟
+    double real_arrive; // 进入就绪队列时的真实调度时钟(毫秒)
+    int reaped;         // 真实子进程是否已回收
+    double cpu_ms;      // 真实子进程实际占用的 CPU 时间(毫秒)
     struct pcd *link;
 } PCB;
 
@@ -40,6 +53,105 @@ typedef struct process_tree_node {
 PCB *ready = NOTHING, *pfend = NOTHING, *p = NOTHING;
 processtreenode *root = NOTHING;
 
+// 真实进程模式: 每个 PCB 对应一个真实子进程, 调度器用 SIGSTOP/SIGCONT 按 SJF 放行
+int real_mode = 0;      // 是否启用真实进程模式 (-x)
+int slice_ms = 10;      // 一个时间单位对应的真实时间片, 单位毫秒 (-t)
+int pin_cpu = -1;       // 子进程绑定的 CPU 编号, -1 表示不绑定 (-c)
+char *exec_cmd = NULL;  // 子进程执行的命令, 为空时子进程空转占用 CPU (-e)
+int sim_clock = 0;      // 模拟时钟, 已执行的时间单位数
+double real_clock = 0;  // 子进程被放行的累计真实时间(毫秒)
+double overhead_ms = 0; // 超出时间片的调度开销累计(毫秒)
+int slice_count = 0;    // 已放行的时间片数
+
+// 插桩计数器
+long sjf_inserts = 0; // 插入就绪队列的次数
+long sjf_steps = 0;   // 插入时在就绪队列中前进的步数
+long pcb_allocs = 0;  // 分配的 PCB 数
+
+double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// 为进程创建真实子进程, 子进程创建后处于停止状态, 等待调度器放行
+void spawn_child(PCB *pr) {
+    pid_t parent = getpid();
+    pid_t child = fork();
+    if (child < 0) {
+        perror("创建子进程失败");
+        exit(1);
+    }
+    if (child == 0) {
+        // 父进程意外退出时随之终止, 否则子进程会一直空转; 设置前父进程已退出则立即结束
+        if (prctl(PR_SET_PDEATHSIG, SIGKILL) != 0 || getppid() != parent)
+            _exit(1);
+        setpgid(0, 0); // 独立进程组, 便于连同命令派生的进程一起停止
+        raise(SIGSTOP);
+        if (exec_cmd) {
+            execl("/bin/sh", "sh", "-c", exec_cmd, (char *)NULL);
+            _exit(127);
+        }
+        for (;;)
+            ;
+    }
+    setpgid(child, child);
+    int status;
+    waitpid(child, &status, WUNTRACED); // 确认子进程已停止
+    if (pin_cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(pin_cpu, &set);
+        if (sched_setaffinity(child, sizeof(set), &set) != 0) {
+            perror("绑定 CPU 失败");
+        }
+    }
+    pr->pid = child;
+    pr->ppid = getpid();
+}
+
+double rusage_ms(struct rusage *ru) {
+    return ru->ru_utime.tv_sec * 1000.0 + ru->ru_utime.tv_usec / 1000.0 +
+           ru->ru_stime.tv_sec * 1000.0 + ru->ru_stime.tv_usec / 1000.0;
+}
+
+// 回收子进程(若仍在运行则先终止), 并输出预测值与实测值
+void reap_child(PCB *pr) {
+    struct rusage ru;
+    int status;
+    if (!pr->reaped) {
+        kill(-pr->pid, SIGKILL);
+        wait4(pr->pid, &status, 0, &ru);
+        pr->reaped = 1;
+        pr->cpu_ms = rusage_ms(&ru);
+    }
+    printf("\n进程 [%s] 实测: 预测周转 %d ms, 实际周转 %.2f ms, 预测CPU %d ms, 实际CPU %.2f ms\n",
+           pr->name, (sim_clock - pr->arrive) * slice_ms, real_clock - pr->real_arrive,
+           pr->rtime * slice_ms, pr->cpu_ms);
+}
+
+// 放行子进程一个时间片, 返回子进程是否已自行退出
+int run_slice(PCB *pr) {
+    struct timespec slice = {slice_ms / 1000, (slice_ms % 1000) * 1000000L};
+    struct rusage ru;
+    int status;
+    double start = now_ms();
+    kill(-pr->pid, SIGCONT);
+    nanosleep(&slice, NULL);
+    kill(-pr->pid, SIGSTOP);
+    wait4(pr->pid, &status, WUNTRACED, &ru); // 等待子进程确实停止或退出
+    double elapsed = now_ms() - start;
+    real_clock += elapsed;
+    overhead_ms += elapsed - slice_ms;
+    slice_count++;
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+        pr->reaped = 1;
+        pr->cpu_ms = rusage_ms(&ru);
+        return 1;
+    }
+    return 0;
+}
+
 int geti() {
     char ch;
     int i = 0;
@@ -88,6 +200,7 @@ processtreenode *insert_process_tree(processtreenode *root, PCB process) {
 
 void SJF() {
     PCB *tp, *tempp;
+    COUNT(sjf_inserts, 1);
     // 如果就绪队列为空
     if (!ready) {
         // 将当前进程设置为就绪队列的第一个进程
@@ -101,6 +214,7 @@ void SJF() {
         tempp = NULL;
         // 遍历就绪队列，直到到达末尾或找到执行时间更短的进程
         while (tp && p->ntime >= tp->ntime) {
+            COUNT(sjf_steps, 1);
             // 更新前一个节点指针
             tempp = tp;
             // 移动到就绪队列中的下一个节点
@@ -128,18 +242,24 @@ void input() {
     for (i = 0; i < num; i++) {
         printf("\nprocess %d\n", i + 1);
         p = getpch(PCB);
+        COUNT(pcb_allocs, 1);
         printf(" 输入进程名称: ");
         scanf("%s", p->name);
         printf(" 输入进程执行的时间: ");
         p->ntime = geti();
         p->rtime = 0;
         p->state = 'w';
-        // p->pid = getpid();   // 设置当前进程的 pid
-        // p->ppid = getppid(); // 设置当前进程的 ppid
-        printf(" 输入进程pid: ");
-        scanf("%d", &p->pid);
-        printf(" 输入进程ppid: ");
-        scanf("%d", &p->ppid);
+        p->arrive = sim_clock;
+        p->real_arrive = real_clock;
+        p->reaped = 0;
+        if (real_mode) {
+            spawn_child(p); // 设置为真实子进程的 pid 和 ppid
+        } else {
+            printf(" 输入进程pid: ");
+            scanf("%d", &p->pid);
+            printf(" 输入进程ppid: ");
+            scanf("%d", &p->ppid);
+        }
         p->link = NOTHING;
         SJF();
         // 将进程插入到二叉树中
@@ -182,6 +302,9 @@ void check() {
 
 void destroy() {
     printf("\n进程 [%s] 已完成\n", ready->name);
+    if (real_mode) {
+        reap_child(ready);
+    }
     p = ready;
     ready = ready->link;
     free(p);
@@ -189,9 +312,11 @@ void destroy() {
 
 void running() {
     ready->state = 'r';
+    int exited = real_mode && run_slice(ready); // 命令提前结束时视为进程完成
     (ready->rtime)++;
+    sim_clock++;
     check();
-    if (ready->rtime == ready->ntime) {
+    if (ready->rtime == ready->ntime || exited) {
         destroy();
     }
 }
@@ -211,6 +336,9 @@ void destroyByHand() {
         if (strcmp(current->name, target_name) == 0) {
             // 找到目标进程
             printf("\n进程 [%s] 已销毁\n", current->name);
+            if (real_mode) {
+                reap_child(current);
+            }
             if (previous == NOTHING) {
                 // 目标进程是队列的第一个进程
                 ready = current->link;
@@ -253,13 +381,90 @@ void showProcessTree() {
     printf("+---------------+---------------+---------------+\n");
     inorderTraversal(root);
 }
-int main() {
+// 基准测试: 以种子生成 ops 次操作, 三分之二为新进程(执行时间 1~100)按 SJF 插入就绪队列, 其余让队首进程运行完毕出队
+void benchmark(int max_scale, uint64_t seed) {
+    BenchCounter counters[] = {{"sjf_inserts", &sjf_inserts}, {"sjf_steps", &sjf_steps}, {"pcb_allocs", &pcb_allocs}};
+    BenchHistogram histogram;
+    for (int i = 0; i < BENCH_SCALES; ++i) {
+        int ops = bench_scale(max_scale, i);
+        bench_reset(&histogram, counters, 3);
+        bench_seed(seed);
+        long start = bench_now_ns();
+        for (int op = 0; op < ops; ++op) {
+            int ntime = 1 + bench_range(100), arrive = bench_range(3);
+            long t = bench_now_ns();
+            if (!ready || arrive) {
+                p = getpch(PCB);
+                COUNT(pcb_allocs, 1);
+                snprintf(p->name, sizeof(p->name), "p%d", op % 100000000);
+                p->state = 'w';
+                p->ntime = ntime;
+                p->rtime = 0;
+                p->pid = op;
+                p->ppid = 0;
+                p->link = NOTHING;
+                SJF();
+            } else {
+                p = ready;
+                ready = ready->link;
+                free(p);
+            }
+            bench_record(&histogram, bench_now_ns() - t);
+        }
+        bench_report("process", "sjf", ops, seed, ops, bench_now_ns() - start, &histogram, counters, 3);
+        while (ready) {
+            p = ready;
+            ready = ready->link;
+            free(p);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int max_scale = 0, opt;
+    uint64_t seed = 1;
+    const char *output = NULL;
+    while ((opt = getopt(argc, argv, "xt:c:e:R:S:o:")) != -1) {
+        switch (opt) {
+        case 'x':
+            real_mode = 1;
+            break;
+        case 't':
+            slice_ms = atoi(optarg) > 0 ? atoi(optarg) : 10;
+            break;
+        case 'c':
+            pin_cpu = atoi(optarg);
+            break;
+        case 'e':
+            exec_cmd = optarg;
+            break;
+        case 'R':
+            max_scale = atoi(optarg);
+            break;
+        case 'S':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            fprintf(stderr, "用法: %s [-x] [-t 时间片毫秒] [-c CPU编号] [-e 命令] [-R 基准最大规模] [-S 种子] [-o 结果文件(.json/.csv)]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (max_scale > 0) {
+        if (bench_open(output) != 0)
+            return 1;
+        benchmark(max_scale, seed);
+        bench_close();
+        return 0;
+    }
     display_banner();
     char ch;
     input();
     while (ready != NOTHING) {
         printf("\n按\033[34mi\033[0m加入新的进程, 按\033[31md\033[0m销毁进程, "
-               "按\033[36ms\033[0m显示当前进程树, 按\033[31mr\033[0m键继续...");
+               "按\033[36ms\033[0m显示当前进程树, 按\033[32ma\033[0m运行至结束, 按\033[31mr\033[0m键继续...");
         fflush(stdin);
         // ch = getchar();
         scanf("%s", &ch);
@@ -275,8 +480,17 @@ int main() {
         if (ch == 'r' || ch == 'R') {
             running();
         }
+        if (ch == 'a' || ch == 'A') {
+            while (ready != NOTHING) {
+                running();
+            }
+        }
     }
     printf("\n\n全部进程执行完毕\n");
+    if (real_mode && slice_count > 0) {
+        printf("调度开销: 共 %d 个时间片, 累计 %.2f ms, 平均每片 %.3f ms\n",
+               slice_count, overhead_ms, overhead_ms / slice_count);
+    }
     getchar();
     return 0;
 }